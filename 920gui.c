@@ -196,6 +196,16 @@ INT32 instruction, f, a, m;
 INT64 fCount[] =     // function code counts
                           {0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L};
 
+/* Predecoded instructions, one entry per store location */
+typedef struct {
+  INT32 instruction;   // instruction word as fetched from store
+  INT32 a;             // address with module bits of its location added
+  unsigned char f;     // function code
+  unsigned char bMod;  // TRUE => B modified
+  unsigned char valid; // FALSE => entry must be decoded before use
+} DECODED;
+DECODED decoded [STORE_SIZE];
+
 /* Tracing */
 INT32 traceOne      = FALSE; // TRUE => trace current instruction only
 
@@ -220,6 +230,7 @@ void  catchInt();              // interrupt handler
 INT32 addtoi(char* arg);       // read numeric part of argument
 void  emulate();               // run emulation
 void  checkAddress(INT32 addr);// check address within store bounds
+void  decode(INT32 addr);      // predecode instruction at addr
 void  clearStore();            // clear main store
 void  readStore();             // read in a store image
 void  tidyExit();              // tidy up and exit
@@ -944,14 +955,15 @@ void emulate () {
       store[scReg]++;
       checkAddress(lastSCR);
 
-      // fetch and decode instruction;
-      instruction = store[lastSCR];
-      f = (instruction >> FN_SHIFT) & FN_MASK;
-      a = (instruction & ADDR_MASK) | (lastSCR & MOD_MASK);
+      // fetch instruction, decoding it only if not already predecoded
+      if ( ! decoded[lastSCR].valid ) decode(lastSCR);
+      instruction = decoded[lastSCR].instruction;
+      f = decoded[lastSCR].f;
+      a = decoded[lastSCR].a;
       fCount[f]+=1; // track number of executions of each function code
 
       // perform B modification if needed
-      if ( instruction >= BIT18 )
+      if ( decoded[lastSCR].bMod )
         {
   	  m = (a + store[bReg]) & MASK16;
 	  emTime += 6;
@@ -965,7 +977,7 @@ void emulate () {
 
         case 0: // Load B
 	    checkAddress(m);
-	    qReg = store[m]; store[bReg] = qReg;
+	    qReg = store[m]; store[bReg] = qReg; // B is never predecoded
 	    emTime += 30;
 	    break;
 
@@ -983,6 +995,7 @@ void emulate () {
           case 3: // Store Q
 	    checkAddress(m);
 	    store[m] = qReg >> 1;
+	    INVALIDATE(m);
 	    emTime += 25;
 	    break;
 
@@ -1003,6 +1016,7 @@ void emulate () {
 	      {
 		checkAddress(m);
 	        store[m] = aReg;
+		INVALIDATE(m);
 	      }
 	    emTime += 25;
 	    break;
@@ -1044,6 +1058,7 @@ void emulate () {
           case 10: // increment in store
 	    checkAddress(m);
  	    store[m] = (store[m] + 1) & MASK18;
+	    INVALIDATE(m);
 	    emTime += 24;
 	    break;
 
@@ -1051,6 +1066,7 @@ void emulate () {
 	    {
 	      qReg = store[scReg] & MOD_MASK;
 	      store[m] = store[scReg] & ADDR_MASK;
+	      INVALIDATE(m);
 	      emTime += 30;
 	      break;
 	    }
@@ -1286,6 +1302,16 @@ void checkAddress(INT32 addr)
         }
 }
 
+void decode(INT32 addr)
+{
+  DECODED *d = &decoded[addr];
+  d->instruction = store[addr];
+  d->f     = (d->instruction >> FN_SHIFT) & FN_MASK;
+  d->a     = (d->instruction & ADDR_MASK) | (addr & MOD_MASK);
+  d->bMod  = ( d->instruction >= BIT18 );
+  d->valid = ( addr >= REG_LOCS ); // SCR and B change on every instruction
+}
+
 
 /**********************************************************/
 /*             EMU STORE DUMP AND RECOVERY                */
@@ -1294,6 +1320,7 @@ void checkAddress(INT32 addr)
  
 void clearStore() {
   for ( INT32 i = 0 ; i < STORE_SIZE ; i++ ) store[i] = 0;
+  memset(decoded, 0, sizeof(decoded)); // nothing predecoded yet
   if  ( verbose & 1 )
     fprintf(diag, "Store (%d words) cleared\n", STORE_SIZE);
 }
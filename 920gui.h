@@ -208,9 +208,13 @@ textview {\
 #define SCRLEVEL4  6
 #define BREGLEVEL1 1
 #define BREGLEVEL4 7
+#define REG_LOCS   8 // SCR and B locations lie below this and are never predecoded
 
 #define STORE_SIZE 16384 // 16K
 
+// Mark predecoded instruction at addr as stale after a store into it
+#define INVALIDATE(addr) (decoded[addr].valid = FALSE)
+
 #define REEL 10*12*1000  // reel of paper tape in characters (1,000 feet, 10 ch/in)
 
 #define PAPER_WIDTH  3600  // 0.1 mm steps - 34cm max on B-L plotter
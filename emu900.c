@@ -2,7 +2,7 @@
 
 // Emulator for Elliott 903 / 920B.
 // Does not implement 'undefined' effects.
-// Has simplified handling of priority levels and initial orders.
+// Has simplified handling of initial orders.
 // No support (as yet) for: interactive use of teletype, line printer, 
 // card reader or magnetic tape.
 
@@ -13,9 +13,17 @@
 //    LIBPNG for plotter output
 
 // Usage: emu900 [-d?] [-reader=file] [-punch=file] [-ttyin=file] [-plot=file]
-//        [-store=file] [-d|-dfile] [-a|-abandon=integer] [-h|-height=integer]
+//        [-store=file] [-snapshot=file] [-resume=file] [-record=file]
+//        [-replay=file] [-d|-dfile]
+//        [-D|-debug] [-c|-checkpoint=integer] [-a|-abandon=integer] [-b|-batch=file]
+//        [-B|-break=address[:n][:A|Q|B op value]]
+//        [-btrace=file] [-decode=file] [-C|-coverage=file]
+//        [-e|-engine=integer] [-P|-profile=integer] [-g|-callgraph=file]
+//        [-h|-height=integer] [-I|-interrupt=device:level] [-l|-loopstop]
 //        [-j|-jump=integer] [-m|-monitor=address] [-p|-Pen=integer]
-//        [-r|-rtrace=integer] [-s|-start=address] [-t|-trace=integer]
+//        [-r|-rtrace=integer] [-s|-start=address] [-S|-speed=integer]
+//        [-t|-trace=integer] [-T|-threads=integer] [-verify]
+//        [-W|-watch=address[-address][:log|trace|stop]]
 //        [-w|-width=integer] [-v|-verbose=integer] [-?|--help] [--usage]
 
 // Verbosity is controlled by the -v argument.  The level of reporting can be selected
@@ -28,6 +36,13 @@
 //
 // By default diagnostic reports are written to stderr, unless the dfile argument is
 // present in which case the reports are written to the file log.txt.
+//
+// Printing traces slows emulation greatly.  The -btrace argument writes the
+// instructions traced to a file as fixed size binary records instead, from
+// a ring in memory emptied in large blocks by a thread of their own, and
+// -decode prints such a file to stdout exactly as the trace would have been
+// printed.  Other reports, such as input/output characters, are still
+// printed.  With -batch the file is written in each job's output directory.
 
 // At beginning reads in contents of store from the file .store by default unless
 // overridden by the -store argument. If the file cannot be found the store is set to
@@ -35,6 +50,92 @@
 // file, unless there have been catastrophic errors. This is to simulate
 // retention of data in core store between entry points.
 
+// The -snapshot argument saves the complete machine state (store, registers,
+// priority level, instruction count and time, reader, teletype input and
+// punch positions and plotter pen) to a binary file at the end of the run,
+// as the store is saved.  The -resume argument starts a run from such a file
+// rather than the store image and jump address, so that a run stopped by
+// -abandon carries on exactly where it left off.  The punch output is cut
+// back to its length when the snapshot was taken.  Instruction counts carry
+// on from the snapshot, so -abandon limits the total.  With -batch both
+// files are in each job's output directory.
+
+// The -record argument writes every character read from the paper tape
+// reader or teletype, and running off the end of either, to a compact binary
+// log together with the count of the instruction reading it.  The -replay
+// argument feeds such a log back in place of the reader and teletype input
+// files, which are neither read nor rewritten, so that a run can be repeated
+// exactly.  Replay stops with a failure if the program asks for input from
+// a different device or at a different instruction from the run recorded.
+// With -batch both files are in each job's output directory.
+
+// The -debug argument takes a checkpoint of the machine state every
+// -checkpoint instructions (1,000,000 by default), keeping the latest 64,
+// and when the run stops, for whatever reason, reads debugging commands from
+// stdin.  These move back and forth over the instructions executed since the
+// oldest checkpoint, printing the machine state as a trace would:
+//
+//    s [n]  -- step forward n instructions, tracing each
+//    rs [n] -- step back n instructions
+//    rc a   -- back to the last execution of the instruction at address a
+//    rw a   -- back to the last change to the word at address a
+//    c      -- forward to the stop
+//    p      -- print the machine state
+//    q      -- quit, leaving the machine as it stopped
+//
+// An earlier instruction is reached by restoring the nearest checkpoint
+// before it and executing forward, teletype output sent already being
+// suppressed.  -debug is ignored by -batch.
+
+// The -profile argument reports, when the run stops, the 40 addresses at
+// which most simulated time was spent, with the instruction at each.  With
+// -profile=0 every instruction is counted and timed exactly, at the cost of
+// running the slower monitored form of the engine.  With -profile=n the
+// instruction last executed is sampled every n microseconds of simulated
+// time, which leaves the chosen engine at full speed; the translating
+// engines step any block which might reach a sample, so every engine
+// samples the same instructions.
+
+// The -callgraph argument follows subroutine calls, recognised as a Store S
+// followed by a jump, and their returns, recognised as a jump to the
+// instruction after the jump of a call.  When the run stops the subroutines
+// taking most time are listed by entry address, with their calls and
+// instructions executed and simulated time taken both in total and in the
+// subroutine itself, and the call graph is written to the file given in the
+// folded stack form read by flame graph tools, weighted by microseconds of
+// simulated time.  With -batch the file is written in each job's output
+// directory.
+
+// The -coverage argument keeps bitmaps of the words of the store executed,
+// read and written by instructions during the run.  At the end they are
+// written to the file given, as the eight bytes E900COV1 followed by the
+// executed, read and written bitmaps of 2048 bytes each, the bit for word
+// n being bit n % 8 of byte n / 8, and listed as ranges of addresses.
+// Each instruction is marked as it is decoded, and each translated block
+// the first time it runs to the end, so the engines are hardly slowed,
+// except that instructions which are B modified or load B are decoded every
+// time, as the words they address can change.  With -batch the file is
+// written in each job's output directory.
+
+// The -watch argument, which may be given any number of times, watches a
+// location or range of locations, reporting each store into them with the
+// value before and after and the instruction making it.  A watch ending
+// :trace also traces that instruction and one ending :stop stops the run
+// after it, as -abandon would.  Watched locations are only checked by the
+// instructions storing into the store, so the switch or threaded engine is
+// used, without the checks made after every instruction by -monitor.
+
+// The -break argument, which may be given any number of times, sets a
+// breakpoint, stopping the run with exit code 32 before the instruction at
+// the address given is executed.  A count n stops only from the nth time
+// the instruction is reached, and a condition such as A<0 or B!=3 only
+// when the register, taken as signed, compares with the value.  The stop
+// leaves the machine exactly as it was before the instruction, so -debug
+// can look back from it, and a -snapshot taken there carries on with
+// -resume from the breakpoint without stopping there again.  Breakpoints
+// are kept in the predecoded instructions, which are never valid at a
+// breakpoint, so only instructions at a breakpoint are slowed.
+
 // Paper tape input from the file .reader unless overridden by the -reader argument on
 // the command line. At the end it copies any unconsumed  input back to the file
 // overwriting previous content, unless there have been catastrophic errors. This is to
@@ -56,6 +157,28 @@
 // There is a limit of output characters on paper tape or teletype roughly equal to a
 // reel of paper tape (120,000 characters).
 
+// Simulated time allows for peripherals running alongside the program: an
+// input/output instruction waits until its device is ready, then leaves it
+// busy for as long as the character takes (4ms reader, 9.1ms punch, 100ms
+// teletype, 3.3ms plotter step or 20ms pen movement), so computing between
+// characters costs no time unless it takes longer than the device.
+
+// Each of priority levels 1 (highest) to 4 has its own SCR and B register,
+// in locations 0 and 1 for level 1 up to 6 and 7 for level 4.  Execution
+// starts in level 1.  The level terminate instruction (15 7168) ends the
+// level running, returning to the level of highest priority interrupted
+// (level 4 if none) or to a level requested meanwhile with priority over
+// it.  The -interrupt argument, which may be given once for each device,
+// makes the device (reader, ttyin, punch, ttyout or plotter) request an
+// interrupt on a level 1 to 3 whenever it becomes ready.  An interrupt
+// with priority over the level running suspends that level and continues
+// the interrupting level from its SCR.  An interrupt is taken at the end of
+// the instruction during which it is requested by every engine, translated
+// blocks making one test each to find those which might be interrupted,
+// which are stepped instead.  A dynamic stop while an interrupt can still
+// come waits for it rather than ending the run, so interrupt driven
+// programs need no busy-wait fallbacks.  -interrupt disables -loopstop.
+
 // Plotter output is sent to the file .plot.png unless overridden by a -plot argument.
 // The output is in a PHG format.
 
@@ -83,6 +206,58 @@
 // will start from whichever condition occurs first.  The address part of -start must not
 // exceed the available store size.
 
+// The -engine argument selects how instructions are dispatched: 0 (the default)
+// uses a single switch on the function code, 1 uses direct threaded code with
+// a separate indirect jump at the end of each function code.  The threaded
+// engine needs a compiler supporting GCC's "labels as values" and gives
+// identical results.  2 translates straight line runs of instructions ending
+// in a jump or i/o into blocks of micro-ops which are run without checking
+// for tracing, monitoring, dynamic stops and the instruction limit between
+// instructions.  Any store into a translated block discards it.  Engine 2
+// reverts to engine 0 if tracing or monitoring is requested.  It also fast
+// forwards idle loops, which repeat a block with no stores or i/o leaving A
+// and Q unchanged, up to the instruction limit or the next interrupt, and
+// computes counting loops, which only increment a location, load it and
+// jump back while it is negative (10 x; 4 x; 9 back), in one step for all
+// their iterations.
+// 3 is engine 2 with blocks executed often compiled to native x86-64 code,
+// falling back to the block interpreter for i/o and less common cases.  It
+// is only available on x86-64 hosts.  With -verify each run of a compiled
+// block without i/o is repeated through the block interpreter from the
+// same state, and any difference in the machine state left ends the run
+// with a failure.  This checks the compiler, at a great cost in speed.
+
+// The -loopstop argument extends dynamic stop detection to longer loops.  The
+// machine state (A, Q, B, SCR, priority level, a count of writes to the store
+// and a count of i/o instructions) is sampled at the start of each translated
+// block and compared with one saved at exponentially increasing intervals
+// (Brent's algorithm).  A repeated state cannot change again, so is treated
+// as a dynamic stop at the start of the loop.  -loopstop selects engine 2,
+// unless engine 3 is selected, and is ignored if tracing or monitoring is
+// requested.
+
+// The -speed argument paces emulation against the wall clock: 1 runs at the
+// speed of a real 903, 10 at ten times that speed, and 0 runs unpaced but
+// allows pausing.  Pacing sleeps whenever emulation gets a millisecond or
+// more ahead of the wall clock, so never sleeps once per instruction.  While
+// paced, sending the emulator SIGUSR1 pauses it and sending another resumes
+// it, the pause being excluded from pacing.  Wall clock drift is reported at
+// the end under verbose & 1.
+
+// The -batch argument runs each job listed in a file on a machine of its own,
+// spread over a pool of worker threads (-threads, by default one per
+// processor).  Each line of the file gives the reader, teletype input, store
+// and output paths of a job separated by spaces, blank lines and lines
+// starting with # being ignored.  The store is read and written back as in
+// a single run.  The punch, plotter, stop and residual tape files are written
+// to the output directory, created if need be, along with the teletype output
+// in .ttyout.  The other arguments apply to every job, except that -speed
+// cannot be used.  Once all jobs are done a summary giving the exit code,
+// instructions executed and simulated time of each is printed, and the
+// emulator exits with 1 if any job failed, otherwise 0.  SIGINT ends every
+// job running as an error would, so its files are still written, and starts
+// no more; SIGUSR1 pauses and resumes every job running.
+
 // Addresses for the -start and -monitor arguments can be written in the form m^a where
 // m represents an 8K store module number and a an address within the selected store
 // module.
@@ -100,9 +275,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
 #include <signal.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <png.h>
 #include <popt.h>
 
@@ -120,6 +305,11 @@
 #define STORE_FILE ".store"    // store image - n.b., ERR_FOPEN_STORE_FILE
 #define PLOT_FILE  ".plot.png" // plotter output as png file
 #define STOP_FILE  ".stop"     // dynamic stop address
+#define TTYOUT_FILE ".ttyout"  // teletype output of a batch job
+#define SNAP_MAGIC "E900SNP5"  // first bytes of a snapshot file
+#define LOG_MAGIC  "E900LOG1"  // first bytes of an input record
+#define TRACE_MAGIC "E900TRC1" // first bytes of a binary trace
+#define COVER_MAGIC "E900COV1" // first bytes of a coverage file
 
 #define USAGE "Usage: emu900[-adjmrstv] <reader file> <punch file> <teletype file>\n"
 #define ERR_FOPEN_DIAG_LOGFILE  "Cannot open log file"
@@ -129,6 +319,7 @@
 #define ERR_FOPEN_PLOT_FILE     "Could not open plotter output file for writing - "
 #define ERR_FOPEN_STORE_FILE    "Could not open store dump file for writing - "
 #define ERR_FOPEN_STOP_FILE     "Could not open stop file for writing - "
+#define ERR_FOPEN_SNAP_FILE     "Could not open snapshot file for writing - "
 
 // Booleans
 #define TRUE  1
@@ -141,6 +332,19 @@
 #define EXIT_TTYSTOP       4
 #define EXIT_LIMITSTOP     8
 #define EXIT_PUNSTOP      16
+#define EXIT_BREAKSTOP    32
+
+// Execution engines, selected by the -engine argument
+#define ENGINE_SWITCH      0 // single switch on function code
+#define ENGINE_THREADED    1 // direct threaded code using computed gotos
+#define ENGINE_BLOCKS      2 // translated straight line blocks
+#define ENGINE_NATIVE      3 // translated blocks compiled to x86-64 code
+
+#if defined(__x86_64__)
+#define JIT_HOST 1 // native code engine available
+#else
+#define JIT_HOST 0
+#endif
 
 /* Useful constants */
 #define BIT19       01000000
@@ -153,14 +357,121 @@
 #define FN_MASK           15
 #define FN_SHIFT          13
 
-// Locations of B register and SCR for priority levels 1 and 4
-#define SCRLEVEL1  0
-#define SCRLEVEL4  6
-#define BREGLEVEL1 1
-#define BREGLEVEL4 7
+// Locations of SCR and B register for priority levels 1 to 4
+#define SCRLEVEL(l)  (2 * (l) - 2)
+#define BREGLEVEL(l) (2 * (l) - 1)
+#define REG_LOCS   8 // SCR and B locations lie below this and are never predecoded
 
 #define STORE_SIZE 16384 // 16K
 
+// Addresses reachable without a bounds check: operands are masked to 16 bits,
+// SCR holds at most an 18 bit value incremented once more
+#define STORE_REACH  65536 // words of store followed by guard pages
+#define DECODE_REACH BIT19 // entries of decoded followed by guard pages
+
+// Count a store into addr, mark the predecoded instruction there as stale
+// and discard any translated block containing it
+#define INVALIDATE(addr)						\
+  {									\
+    mc->storeWrites++;							\
+    mc->decoded[addr].valid = FALSE;					\
+    if ( mc->decoded[addr].inBlock ) invalidateBlocks(mc, addr);	\
+  }
+
+// Check a store into addr against the watchpoints, the only cost to the
+// store sites of emu900ops.h when none are set being the test of watchMap
+#define WATCH(addr)							\
+  {									\
+    if ( watchMap != NULL && ((watchMap[(addr) >> 3] >> ((addr) & 7)) & 1) ) \
+      {									\
+	RUN_SYNC;							\
+	watchHit(mc, addr);						\
+      }									\
+  }
+
+// Actions on a store into a watched location
+#define WATCH_LOG   0 // report the store ...
+#define WATCH_TRACE 1 //   ... and trace the instruction making it ...
+#define WATCH_STOP  2 //   ... or stop after it
+
+// Translated blocks
+#define BLOCK_MAX     64 // longest straight line run translated as one block
+#define UOP_POOL   65536 // micro-ops available for translated blocks
+#define JIT_THRESHOLD 16 // executions of a block before compiling it
+
+// Idioms executed by translated blocks as a single macro-op (see fuse())
+#define FUSE_NONE        0
+#define FUSE_LOAD_ADD    1 // 4 x; 1 y; 5 z  -- load, add and store
+#define FUSE_INC_TEST    2 // 10 x; 4 x; 7/9 y -- increment, load and test
+#define FUSE_SHIFT_STORE 3 // 14 n; 5 z -- shift and store
+
+// TRUE if micro-op op has function code fn, is not B modified and does not
+// address an SCR location of any level, which runBlock() only updates
+// between micro-ops
+#define FUSIBLE(op, fn)							\
+  ( (op).f == (fn) && ! (op).bMod && ( (op).a >= REG_LOCS || ((op).a & 1) ) )
+
+// Input record entries, see recordInput()
+#define INPUT_TAPE 0 // paper tape reader ...
+#define INPUT_TTY  1 //   ... or teletype, or'ed with ...
+#define INPUT_END  2 //   ... this if run off the end of the input
+
+// Profiling
+#define PROFILE_LINES 40 // addresses listed by printProfile() and printCalls()
+#define CALL_DEPTH   256 // calls followed without a return, deeper calls are ignored
+
+// Binary tracing
+#define TRACE_RING  (1 << 18) // records held in memory, a power of two
+#define TRACE_BLOCK (1 << 13) // records written out at a time
+#define TRACE_POLL  100000L   // nanoseconds between checks of the ring when idle
+
+// Store coverage, see coverInstruction()
+#define COVER_EXECUTED 0 // bitmap of words executed ...
+#define COVER_READ     1 //   ... read ...
+#define COVER_WRITTEN  2 //   ... and written, in this order
+#define COVER_KINDS    3
+#define COVER_BYTES    (STORE_SIZE / 8) // bytes in each bitmap
+#define COVER(kind, addr)						\
+  (mc->coverage[(kind) * COVER_BYTES + ((addr) >> 3)] |= 1 << ((addr) & 7))
+#define COVERED(kind, addr)						\
+  ((mc->coverage[(kind) * COVER_BYTES + ((addr) >> 3)] >> ((addr) & 7)) & 1)
+#define COVER_RANGES   5 // ranges listed on each line by writeCoverage()
+#define COVER_BY_LEVEL(f, m) /* Store A into the initial instructions, */	\
+  ((f) == 5 && (m) >= 8180 && (m) <= 8191) /* ignored in level 1 */
+
+// Reverse execution
+#define CHECKPOINTS 64 // checkpoints kept for -debug, the oldest being dropped
+
+// Peripherals, numbering the devices kept busy by the event scheduler
+#define DEV_READER   0
+#define DEV_TTYIN    1
+#define DEV_PUNCH    2
+#define DEV_TTYOUT   3
+#define DEV_PLOTTER  4
+#define DEVICES      5
+
+// Peripheral timing, in microseconds
+#define IO_TIME         25 // i/o instruction finding its device ready (assumed)
+#define READER_TIME   4000 // 250 ch/s reader
+#define TTYIN_TIME  100000 // 10 ch/s teletype
+#define PUNCH_TIME    9091 // 110 ch/s punch
+#define TTYOUT_TIME 100000 // 10 ch/s teletype
+#define PLOT_STEP_TIME 3300 // 3.3ms plotter step ...
+#define PLOT_PEN_TIME 20000 //   ... or 20ms to raise or lower pen
+
+// Events scheduled by emulated time, see schedule()
+#define EVENTS      16 // events which may be pending at once
+#define EVENT_READY  0 // device becomes ready, added to device number
+
+// Longest a shift can take: 24us and 7us a place, up to 2048 places
+#define SHIFT_MAX_TIME (24 + 7 * 2048)
+
+// Real time pacing
+#define PACE_BATCH 1000000L // nanoseconds ahead of wall clock before sleeping
+#define PAUSE_POLL 10000000L // nanoseconds between checks for end of pause
+#define BATCH_POLL 1000000L  // emulated us between a batch job's checks for signals
+#define NEVER   INT64_MAX   // emTime of pacing check when none needed
+
 #define REEL 10*12*1000  // reel of paper tape in characters (1,000 feet, 10 ch/in)
 
 #define PAPER_WIDTH  3600  // 0.1 mm steps - 34cm max on B-L plotter
@@ -176,63 +487,358 @@ typedef int32_t INT32;
 typedef int64_t INT64;
 
 
-/* Diagnostics related variables */
-FILE *diag      = NULL;      // diagnostics output - set to either  stderr or .log
-
-/* File handles for peripherals */
-FILE *ptrFile   = NULL;       // paper tape reader
-FILE *punFile   = NULL;       // paper tape punch
-FILE *ttyiFile  = NULL;       // teleprinter input
-FILE *ttyoFile  = NULL;       // teleprinter output
+/* Diagnostics related variables, common to all machines */
+__thread FILE *diag = NULL; // diagnostics output - set to either  stderr or .log,
+                            // or for a batch job a buffer of its own
 
 INT32 verbose   = 0;       // no diagnostics by default
 INT32 diagCount = -1;      // turn diagnostics on at this instruction count
-INT32 abandon   = -1;      // abandon on this instruction count 
 INT32 diagFrom  = -1;      // turn on diagnostics when first reach this address
 INT32 diagLimit = -1;      // stop after this number of instructions executed
 INT32 monLoc    = -1;      // report if this location changes
-INT32 monLast   = -1;
-
-/* Input output streams */
-char *ptrPath   = RDR_FILE;    // path for reader input file
-char *punPath   = PUN_FILE;    // path for punch output file
-char *ttyInPath = TTYIN_FILE;  // path for teletype input file
-char *plotPath  = PLOT_FILE;   // path for plotter output
-char *storePath = STORE_FILE;  // path for store image
-
-INT32 lastttych   = -1; // last tty character punched
-INT32 punchCount  = -1; // count of paper tape characters punched
-INT32 ttyCount    = -1; // count of teletype character typed
-
-/* Emulated store */
-INT32 store [STORE_SIZE];
-INT32 storeValid = FALSE; // set TRUE when a store image loaded
-
-/* Machine state */
-INT32 opKeys = 8181; // setting of keys on operator's control panel, overidden by
-                     // -j option
-INT32 aReg  = 0, qReg  = 0; // a and q registers
-INT32 bReg  = BREGLEVEL1; // address in store of B register 
-INT32 scReg = SCRLEVEL1;  // address in store of B register
-INT32 lastSCR;       // used to detect dynamic loops
-INT32 level = 1;     // priority level
-INT64 iCount = 0L;   // count of instructions executed
-INT32 instruction, f, a, m;
-INT64 fCount[] =     // function code counts
-                          {0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L,0L};
-
-/* Tracing */
-INT32 traceOne      = FALSE; // TRUE => trace current instruction only
-
-/* Plotter */
-unsigned char *plotterPaper = NULL;    // != NULL => plotter has been used.
-  
-INT32 plotterPenX, plotterPenY, plotterPenDown, plotterUsed;
-INT32 plotterPaperWidth  = PAPER_WIDTH;
-INT32 plotterPaperHeight = PAPER_HEIGHT;
-INT32 plotterPenSize     = PEN_SIZE;    
-
-char ttyoChar;
+unsigned char *watchMap    = NULL; // != NULL => bit set for each location watched ...
+unsigned char *watchAction = NULL; //   ... and WATCH_LOG, WATCH_TRACE or WATCH_STOP for each
+INT32 watchStops = FALSE;  // TRUE => a watchpoint may stop the run
+INT32 interruptLevel [DEVICES]; // level each device interrupts on, 0 => none ...
+INT32 interrupting = FALSE; //   ... and TRUE => some device interrupts
+INT32 engine    = ENGINE_SWITCH; // execution engine
+INT32 loopStop  = FALSE;   // TRUE => detect loops by repeated machine state
+INT32 speed     = -1;      // multiple of 903 speed, 0 => unlimited, -1 => not paced
+char *batchPath = NULL;    // != NULL => run the jobs listed in this file
+INT32 threads   = 0;       // worker threads for batch jobs, 0 => one per processor
+INT32 debugStop = FALSE;   // TRUE => debug with reverse execution at the stop
+INT32 checkInterval = 1000000; // instructions between checkpoints for -debug
+INT32 verifyNative = FALSE; // TRUE => check compiled blocks against the block interpreter
+char *decodePath = NULL;   // != NULL => print this binary trace as text and exit
+INT32 profileEvery = -1;   // -1 => no profile, 0 => every instruction, n => sample every n us
+
+/* Time in microseconds taken by each function code regardless of its data.
+   Jumps taken, shifts, i/o and B modification add further time. */
+static const INT64 fnTime[16] =
+  { 30, 23, 26, 25, 23, 25, 23, 20, 23, 20, 24, 30, 79, 79, 0, 0 };
+
+/* Predecoded instructions, one entry per store location */
+typedef struct {
+  INT32 instruction;   // instruction word as fetched from store
+  INT32 a;             // address with module bits of its location added
+  unsigned char f;     // function code
+  unsigned char bMod;  // TRUE => B modified
+  unsigned char valid; // FALSE => entry must be decoded before use
+  unsigned char inBlock; // TRUE => may lie within a translated block
+  unsigned char brk;   // TRUE => breakpoint, so never valid
+} DECODED;
+
+/* Translated blocks.  A block is a straight line run of instructions ending
+   with a jump (function codes 7, 8 and 9) or input/output (15), translated
+   into an array of micro-ops which is executed without the end of
+   instruction checks between micro-ops. */
+typedef struct {
+  INT32 instruction;   // instruction word, for diagnostics
+  INT32 a;             // address with module bits of its location added
+  unsigned char f;     // function code
+  unsigned char bMod;  // TRUE => B modified
+  unsigned char fuse;  // FUSE_NONE, or idiom starting at this micro-op
+  INT32 time;          // fixed time of block up to and including this micro-op
+} UOP;
+
+/* Statistics are accounted once per block: iCount, the fixed part of emTime
+   and fCount for the function codes found in the block are added when it
+   completes, and from the micro-ops executed if it is left early. */
+typedef struct {
+  UOP  *ops;           // micro-ops, one per instruction
+  INT32 length;        // number of instructions in block
+  INT32 valid;         // FALSE => not translated or since written to
+  INT32 pure;          // TRUE => no stores or i/o, so only changes A and Q
+  INT32 codes;         // number of different function codes in block
+  unsigned char code [16];      // function codes in block
+  unsigned char codeCount [16]; //   ... and number of each
+  INT32 (*native)();   // != NULL => compiled code, returning micro-ops executed
+  INT32 hits;          // executions since translated, to find blocks to compile
+  INT64 maxTime;       // most time the instructions before the last can take
+  INT32 counted;       // TRUE => counting loop "10 x; 4 x; 9 start", see skipCounted()
+  INT32 covered;       // TRUE => whole block marked in the coverage bitmaps
+} BLOCK;
+
+/* Machine state sampled for -loopstop.  The store cannot have changed
+   between two samples with the same storeWrites. */
+typedef struct {
+  INT32 aReg, qReg, bValue, scrValue, scReg, level;
+  INT64 storeWrites, ioCount;
+} LOOPSTATE;
+
+/* Something to happen at a given emulated time */
+typedef struct {
+  INT64 time;          // emTime at which it happens
+  INT32 type;          // what happens, EVENT_READY + device
+} EVENT;
+
+/* A breakpoint, set by -break */
+typedef struct {
+  INT32 addr;          // address of instruction to stop before
+  INT64 count;         // hits needed before stopping
+  char  reg;           // 'A', 'Q' or 'B' if stopping only when that register ...
+  char  op[3];         //   ... compares by =, !=, <, <=, > or >= ...
+  INT32 value;         //   ... with this signed value
+} BREAKPOINT;
+
+/* Profile of one store address */
+typedef struct {
+  INT64 count;         // executions, or samples taken at this address
+  INT64 time;          // emulated time spent executing it
+} PROFILE;
+
+/* A calling context: a subroutine entered along one chain of calls.  The
+   contexts form a tree, each created after the context calling it, with
+   the first standing for the code outside any call.  printCalls() also
+   uses one per store address to total up each subroutine. */
+typedef struct {
+  INT32 entry;         // address jumped to by the call, -1 for the root
+  INT32 parent;        // context calling this one ...
+  INT32 child;         //   ... first context called from this one ...
+  INT32 sibling;       //   ... and next context called from parent
+  INT64 calls;         // times entered
+  INT64 count, time;   // instructions executed and emulated time, exclusive ...
+  INT64 inCount, inTime; //   ... and inclusive of subroutines called
+} CALLNODE;
+
+/* A call not yet returned from */
+typedef struct {
+  INT32 node;          // context of the subroutine called
+  INT32 ret;           // address of the instruction following the call
+} CALLFRAME;
+
+/* One instruction of a binary trace, holding what printDiagnostics() prints.
+   The function code and address are decoded again from the instruction. */
+typedef struct {
+  INT64 iCount;
+  INT32 scr;           // address of the instruction
+  INT32 instruction;
+  INT32 aReg, qReg;
+  INT32 bValue;        // contents of B
+  INT32 level;         // priority level
+} TRACE;
+
+/* Binary trace records on their way to the trace file.  The emulator adds
+   records at head and a writer thread takes them from tail in blocks, each
+   only ever moving its own index on, so neither needs a lock. */
+typedef struct {
+  TRACE *records;      // TRACE_RING records
+  _Atomic INT64 head;  // records added ...
+  _Atomic INT64 tail;  //   ... and written out
+  _Atomic INT32 done;  // TRUE => no more records are to be added
+  FILE *file;          // trace file
+  pthread_t writer;    // thread writing the trace file
+} TRACERING;
+
+/* Complete machine state, captured by takeSnapshot() and put back by
+   restoreSnapshot().  File positions are 0 for files not yet opened.
+   Marks made on the plotter paper and teletype output are not undone. */
+typedef struct {
+  INT64 iCount, emTime;
+  INT64 storeWrites, ioCount;
+  INT64 fCount [16];
+  INT32 aReg, qReg, bReg, scReg, lastSCR, level;
+  INT32 instruction, f, a;       // last instruction executed, for diagnostics
+  INT32 lastttych, punchCount, ttyCount;
+  INT32 plotterPenX, plotterPenY, plotterPenDown;
+  INT64 ptrPos, ttyiPos, punPos; // reader, teletype input and punch positions
+  INT64 replayPos, replayCount;  // next input to replay and count of the last
+  INT64 ioWait;                  // time waiting for peripherals
+  INT64 interrupts;              // interrupts taken
+  EVENT events [EVENTS];         // events pending ...
+  INT32 eventCount, busy;        //   ... how many and devices busy
+  INT32 active, requests;        // levels interrupted and requested
+  INT32 store [STORE_SIZE];      // last, so that writeSnapshot() can trim it
+} SNAPSHOT;
+
+/* An Elliott 900 machine: everything one emulation changes, so that any
+   number can run in one process.  The registers and counts used by every
+   instruction come first, sharing one cache line. */
+typedef struct {
+  /* Machine state */
+  INT32 *store;        // emulated store, followed by guard pages up to STORE_REACH words
+  DECODED *decoded;    // STORE_SIZE entries followed by guard pages
+  INT64 iCount;        // count of instructions executed
+  INT64 emTime;        // crude estimate of 900 elapsed time
+  INT32 aReg, qReg;    // a and q registers
+  INT32 bReg;          // address in store of B register
+  INT32 scReg;         // address in store of SCR
+  INT32 lastSCR;       // used to detect dynamic loops
+  INT32 f, a, m;       // function code, address and modified address
+  INT32 instruction;   // instruction being executed
+  INT32 level;         // priority level
+  INT32 abandon;       // abandon on this instruction count
+  INT32 opKeys;        // setting of keys on operator's control panel, overidden by
+                       // -j option
+  INT32 storeValid;    // set TRUE when a store image loaded
+  INT64 storeWrites;   // count of stores into the store, excluding B and SCR
+  INT64 ioCount;       // count of i/o instructions executed
+  INT64 fCount [16];   // function code counts
+
+  /* Event scheduler */
+  EVENT events [EVENTS]; // heap of pending events, the earliest first ...
+  INT32 eventCount;    //   ... and how many
+  INT32 busy;          // bit set for each device busy
+  INT64 ioWait;        // time i/o instructions and dynamic stops have waited for devices
+
+  /* Priority levels */
+  INT32 active;        // bit set for each level entered and not terminated
+  INT32 requests;      // bit set for each level with an interrupt requested
+  INT64 interrupts;    // count of interrupts taken
+
+  /* Tracing */
+  INT32 monLast;       // last value of monitored location
+  INT32 *watchLast;    // != NULL => last value of each store location, for watchpoints
+  INT64 *breakHits;    // != NULL => hits on each breakpoint ...
+  INT64 breakAt;       //   ... and iCount when the run last stopped at one
+  INT32 traceOne;      // TRUE => trace current instruction only
+  INT32 tracing;       // TRUE => tracing enabled
+
+  /* Input output streams */
+  char *ptrPath;       // path for reader input file
+  char *punPath;       // path for punch output file
+  char *ttyInPath;     // path for teletype input file
+  char *plotPath;      // path for plotter output
+  char *storePath;     // path for store image
+  char *stopPath;      // path for dynamic stop address
+  char *residuePath;   // path unread paper tape is copied to
+  char *snapPath;      // != NULL => path to write snapshot to at end
+  char *resumePath;    // != NULL => path of snapshot to start from
+  FILE *ptrFile;       // paper tape reader
+  FILE *punFile;       // paper tape punch
+  FILE *ttyiFile;      // teleprinter input
+  FILE *ttyoFile;      // teleprinter output
+  INT32 lastttych;     // last tty character punched
+  INT32 punchCount;    // count of paper tape characters punched
+  INT32 ttyCount;      // count of teletype character typed
+
+  /* Translated blocks */
+  BLOCK *blocks;       // translated blocks indexed by start address
+  UOP   *uops;         // pool of micro-ops used by blocks
+  INT32  uopsUsed;     // micro-ops allocated from pool
+  INT64  blocksTranslated;  // count of blocks translated
+  INT64  blocksInvalidated; // count of blocks discarded by stores
+  INT64  idleSkipped;       // instructions of idle loops not executed
+  INT64  countedSkipped;    // instructions of counting loops computed in one step
+  INT64  blocksCompiled;    // count of blocks compiled to native code
+  INT64  blocksVerified;    // runs of compiled blocks checked by -verify ...
+  SNAPSHOT *verifyStates;   //   ... against the state before and after runBlock()
+  INT64  idiomsFused;       // count of idioms translated as macro-ops
+
+  /* Native code for translated blocks, see emu900jit.h */
+  unsigned char *code;      // native code, starting with exit code
+  unsigned char *codeExit;  // code common to every block's exit
+  unsigned char *codeStart; // code for blocks, following codeExit
+  unsigned char *cp;        // next byte of code to be compiled
+
+  /* Loop stop detection */
+  LOOPSTATE loopSaved;      // state last saved
+  INT32     loopHaveSaved;  // TRUE => loopSaved set
+  INT64     loopInterval;   // samples between saving the state ...
+  INT64     loopSamples;    //   ... and samples since last saved
+
+  /* Real time pacing */
+  volatile INT64 paceTime;  // emTime at which to next call pace()
+  INT64 paceWall;      // wall clock time in ns at which pacing started ...
+  INT64 paceEm;        //   ... and emTime at that time
+  INT64 paceMaxLag;    // most ns emulation has fallen behind wall clock
+
+  /* Plotter */
+  unsigned char *plotterPaper; // != NULL => plotter has been used.
+  INT32 plotterStarted;        // TRUE => setupPlotter() has been called
+  INT32 plotterPenX, plotterPenY, plotterPenDown;
+  INT32 plotterPaperWidth;
+  INT32 plotterPaperHeight;
+  INT32 plotterPenSize;
+
+  /* Input record and replay */
+  char *recordPath;    // != NULL => path to record input to
+  char *replayPath;    // != NULL => path of input record to replay
+  FILE *recordFile;    // input record being written ...
+  INT64 recordCount;   //   ... and iCount of the last input recorded
+  unsigned char *replayLog; // != NULL => input record being replayed ...
+  INT64 replaySize;    //   ... its length in bytes ...
+  INT64 replayPos;     //   ... position of the next input ...
+  INT64 replayCount;   //   ... and iCount of the last input replayed
+  INT64 inputAt;       // iCount of the input instruction being executed
+
+  /* Profiling */
+  PROFILE *profile;    // != NULL => profile, indexed by address
+  INT64 profileTime;   // emTime when last instruction profiled ...
+  INT64 profileDue;    //   ... or at which to take the next sample
+
+  /* Binary trace */
+  char *tracePath;     // != NULL => path to write binary trace to ...
+  TRACERING *trace;    //   ... and records on their way to it
+
+  /* Call graph */
+  char *callPath;      // != NULL => path to write call graph to at end
+  CALLNODE *callNodes; // != NULL => calling contexts, the root first ...
+  INT32 callNodeCount; //   ... how many are in use ...
+  INT32 callNodeSize;  //   ... and allocated
+  CALLFRAME *callStack; // CALL_DEPTH calls not returned from, the root first ...
+  INT32 callDepth;     //   ... and index of the innermost
+  INT32 callAt;        // address of jump following Store S just executed, else -1
+  INT64 callTime;      // emTime when last instruction charged to a context
+
+  /* Store coverage */
+  char *coverPath;     // != NULL => path to write coverage bitmaps to at end ...
+  unsigned char *coverage; //   ... and the COVER_KINDS bitmaps
+  BLOCK *inBlock;      // translated block being run, for a run ending inside it
+  sigjmp_buf fault;    // emulate() run to return to from catchSegv() ...
+  INT32 faultAddr;     //   ... with the address outside of store
+
+  /* Reverse execution */
+  SNAPSHOT *checkpoints; // ring of CHECKPOINTS checkpoints for -debug ...
+  INT32 checkNext;     //   ... the next to be overwritten ...
+  INT32 checkCount;    //   ... and how many have been taken
+  INT32 debugging;     // TRUE => in debugMachine(), not to be entered again
+  INT64 outputTo;      // teletype output already sent up to this iCount
+
+  /* Batch jobs */
+  INT32 batched;       // TRUE => stopping ends the job rather than the process ...
+  sigjmp_buf finish;   //   ... by jumping back to runJob() with exit code + 1
+} __attribute__((aligned(64))) ELLIOTT900;
+
+/* A batch job, read from one line of the jobs file */
+typedef struct {
+  char *reader;        // paper tape reader input
+  char *ttyin;         // teletype input
+  char *store;         // store image, read at the start and written at the end
+  char *output;        // directory for punch, plotter, teletype and stop files
+  INT32 line;          // line of jobs file
+  INT32 exitCode;      // exit code of job
+  INT64 iCount;        // instructions executed
+  INT64 emTime;        // simulated time
+} JOB;
+
+/* A batch worker thread.  Jobs are dealt out evenly between the workers to
+   start with.  A worker runs its own jobs from the head of its queue and once
+   they are gone steals from the tail of the others'. */
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock; // guards head and tail
+  JOB **queue;         // jobs dealt to this worker
+  INT32 head, tail;    // queue[head] to queue[tail-1] not yet started
+} WORKER;
+
+INT32 (*runLoop)(ELLIOTT900 *mc) = NULL; // execution loop chosen to suit options
+
+volatile sig_atomic_t paused = FALSE; // TRUE => paused by SIGUSR1
+volatile sig_atomic_t stopping = FALSE; // TRUE => batch ended by SIGINT
+ELLIOTT900 *interactive = NULL;         // machine stopped by SIGINT and paused by SIGUSR1
+static __thread ELLIOTT900 *running = NULL; // machine being run by this thread
+static __thread PROFILE *profileSorting = NULL; // profile being sorted by printProfile()
+static __thread CALLNODE *callSorting = NULL; // subroutine totals being sorted by printCalls()
+
+BREAKPOINT *breakpoints   = NULL; // breakpoints set by -break ...
+INT32       breakCount    = 0;    //   ... and how many
+
+ELLIOTT900 *batchSettings = NULL; // machine holding the options for batch jobs
+FILE       *batchDiag     = NULL; // diagnostics output shared by batch jobs ...
+pthread_mutex_t batchDiagLock = PTHREAD_MUTEX_INITIALIZER; //   ... and guarding it
+WORKER     *workers       = NULL; // batch worker threads ...
+INT32       workerCount   = 0;    //   ... and how many
 
 
 /**********************************************************/
@@ -240,31 +846,117 @@ char ttyoChar;
 /**********************************************************/
 
 
-void  decodeArgs(INT32 argc, const char **argv); // decode command line
+void  decodeArgs(ELLIOTT900 *mc, INT32 argc, const char **argv); // decode command line
 void  usage(poptContext optCon, INT32 exitcode, char *error, char *addl);
 void  catchInt();              // interrupt handler
+void  catchPause();            // SIGUSR1 handler, pause or resume
+void  catchSegv(INT32 sig, siginfo_t *info, void *context); // store guard page handler
 INT32 addtoi(char* arg);       // read numeric part of argument
-void  emulate();               // run emulation
-void  checkAddress(INT32 addr);// check address within store bounds
-void  clearStore();            // clear main store
-void  readStore();             // read in a store image
-void  tidyExit();              // tidy up and exit
-void  writeStore();            // dump out store image
-void  printDiagnostics(INT32 i, INT32 f, INT32 a); // print diagnostic information for current instruction
+ELLIOTT900 *newMachine();     // allocate machine with default settings
+void  freeMachine(ELLIOTT900 *mc); // release machine and its store
+void  emulate(ELLIOTT900 *mc); // run emulation
+INT32 runBatch(ELLIOTT900 *settings); // run jobs of batch file, returning exit code
+INT32 readJobs(JOB **jobs);    // read jobs file, returning number of jobs
+void *batchWorker(void *arg);  // batch worker thread
+JOB  *nextJob(WORKER *w);      // next job for worker w to run
+void  runJob(JOB *job);        // run one batch job
+char *joinPath(const char *dir, const char *name); // path of file name in directory dir
+INT32 runSwitch(ELLIOTT900 *mc); // execution loop dispatching through a switch
+INT32 runSwitchLimit(ELLIOTT900 *mc); //   ... checking instruction limit
+INT32 runSwitchDiag(ELLIOTT900 *mc); //   ... checking monitoring and tracing
+INT32 runSwitchFull(ELLIOTT900 *mc); //   ... checking all of these
+INT32 runThreaded(ELLIOTT900 *mc); // execution loop using threaded code
+INT32 runThreadedLimit(ELLIOTT900 *mc); //   ... checking instruction limit
+INT32 runThreadedDiag(ELLIOTT900 *mc); //   ... checking monitoring and tracing
+INT32 runThreadedFull(ELLIOTT900 *mc); //   ... checking all of these
+INT32 runBlocks(ELLIOTT900 *mc); // execution loop using translated blocks
+INT32 runBlock(ELLIOTT900 *mc, BLOCK *blk, INT32 pc); // execute translated block starting at pc
+const UOP *interpretBlock(ELLIOTT900 *mc, BLOCK *blk, INT32 pc); //   ... returning where it ended
+INT32 runNative(ELLIOTT900 *mc, BLOCK *blk, INT32 pc); // execute compiled block starting at pc
+INT32 verifyBlock(ELLIOTT900 *mc, BLOCK *blk, INT32 pc); //   ... and check it against runBlock()
+INT32 finishBlock(ELLIOTT900 *mc, BLOCK *blk, const UOP *op); // account for block executed up to op
+void  accountBlock(ELLIOTT900 *mc, BLOCK *blk, const UOP *op, INT32 cut); // add counts and time of block up to op
+void  skipIdle(ELLIOTT900 *mc, BLOCK *blk, INT64 time); // fast forward idle loop of blk
+void  skipCounted(ELLIOTT900 *mc, BLOCK *blk); // compute iterations of counting loop blk
+INT32 checkLoop(ELLIOTT900 *mc); // check for a repeated machine state
+INT32 writeStop(ELLIOTT900 *mc, INT32 addr); // record dynamic stop address in stop file
+void  startPacing(ELLIOTT900 *mc); // set up real time pacing
+void  pace(ELLIOTT900 *mc);    // keep emulation in step with the wall clock
+INT64 wallClock();             // monotonic wall clock time in ns
+void  sleepFor(INT64 ns);      // sleep for ns nanoseconds
+INT32 stepSwitch(ELLIOTT900 *mc); // execute a single instruction
+void  translate(ELLIOTT900 *mc, INT32 start); // translate block starting at start
+void  fuse(ELLIOTT900 *mc, BLOCK *blk, INT32 start); // find idioms in block starting at start
+void  invalidateBlocks(ELLIOTT900 *mc, INT32 addr); // discard blocks containing addr
+void  flushBlocks(ELLIOTT900 *mc); // discard all translated blocks
+void  compileBlock(ELLIOTT900 *mc, BLOCK *blk, INT32 start); // compile block to native code
+void  initNative(ELLIOTT900 *mc); // allocate space for native code
+void  freeNative(ELLIOTT900 *mc); // release space for native code
+void  flushNative(ELLIOTT900 *mc); // discard all native code
+INT32 jitStep(ELLIOTT900 *mc, BLOCK *blk, INT32 i); // execute micro-op i on behalf of native code
+void  allocateStore(ELLIOTT900 *mc); // allocate store and decoded with guard pages
+void *allocateGuarded(size_t used, size_t reach); // allocate with guard pages
+void  freeGuarded(void *p, size_t used, size_t reach); // release allocateGuarded() space
+void  decode(ELLIOTT900 *mc, INT32 addr); // predecode instruction at addr
+void  clearStore(ELLIOTT900 *mc); // clear main store
+void  readStore(ELLIOTT900 *mc); // read in a store image
+void  tidyExit(ELLIOTT900 *mc, INT32 reason); // tidy up and exit
+void  stopMachine(ELLIOTT900 *mc, INT32 reason); // exit, or end batch job
+void  writeStore(ELLIOTT900 *mc); // dump out store image
+void  takeSnapshot(ELLIOTT900 *mc, SNAPSHOT *snap); // capture machine state
+void  restoreSnapshot(ELLIOTT900 *mc, const SNAPSHOT *snap); // return to captured state
+FILE *seekFile(ELLIOTT900 *mc, FILE *f, const char *path, const char *mode, INT64 pos); // reposition file
+void  writeSnapshot(ELLIOTT900 *mc, const SNAPSHOT *snap, const char *path); // save snapshot to file
+void  readSnapshot(ELLIOTT900 *mc, SNAPSHOT *snap, const char *path); // load snapshot from file
+void  startRecord(ELLIOTT900 *mc); // open input record for writing
+void  readRecord(ELLIOTT900 *mc); // read input record to replay
+void  recordInput(ELLIOTT900 *mc, INT32 device, INT32 ch); // record an input character
+INT32 replayInput(ELLIOTT900 *mc, INT32 device); // replay an input character
+INT32 runCheckpointed(ELLIOTT900 *mc); // run taking checkpoints for -debug
+void  debugMachine(ELLIOTT900 *mc); // debug stopped machine with reverse execution
+INT32 goTo(ELLIOTT900 *mc, const SNAPSHOT *stopped, INT64 to); // move to state after instruction to
+INT64 findLast(ELLIOTT900 *mc, INT32 addr, INT32 watch); // find last execution of or store into addr
+void  printDiagnostics(ELLIOTT900 *mc); // print diagnostic information for current instruction
+void  printTrace(FILE *f, const TRACE *t); // print one instruction of a trace
+void  traceInstruction(ELLIOTT900 *mc); // trace current instruction as text or binary
+void  watchHit(ELLIOTT900 *mc, INT32 addr); // act on store into watched location
+void  schedule(ELLIOTT900 *mc, INT64 time, INT32 type); // add event at time
+void  runEvents(ELLIOTT900 *mc, INT64 until); // make events due by until happen
+void  startIO(ELLIOTT900 *mc, INT32 device, INT64 busy, INT64 pending); // wait for device and keep it busy
+void  requestInterrupt(ELLIOTT900 *mc, INT32 level); // device asks to interrupt on level
+void  takeInterrupt(ELLIOTT900 *mc); // switch to a level requested with priority
+void  terminateLevel(ELLIOTT900 *mc); // return to level of highest priority active
+INT32 awaitInterrupt(ELLIOTT900 *mc); // let time pass at a dynamic stop until an interrupt
+INT32 breakHit(ELLIOTT900 *mc, INT32 addr); // TRUE => stop at breakpoint at addr
+void  startTrace(ELLIOTT900 *mc); // open binary trace and start its writer
+void  endTrace(ELLIOTT900 *mc); // write out rest of binary trace
+void *traceWriter(void *ring); // thread writing out binary trace records
+INT32 decodeTrace(const char *path); // print binary trace as text
+void  printProfile(ELLIOTT900 *mc); // print addresses taking most time
+INT32 compareProfile(const void *x, const void *y); // order addresses by time
+void  traceCalls(ELLIOTT900 *mc); // follow subroutine calls and returns
+INT32 callNode(ELLIOTT900 *mc, INT32 parent, INT32 entry); // find or add calling context
+void  printCalls(ELLIOTT900 *mc); // print subroutines and write call graph
+void  coverInstruction(ELLIOTT900 *mc, INT32 addr); // mark instruction about to be executed
+void  coverBlock(ELLIOTT900 *mc, BLOCK *blk, const UOP *op); // mark block executed up to op
+void  coverOperand(ELLIOTT900 *mc, INT32 f, INT32 m); // mark word addressed by function f
+void  writeCoverage(ELLIOTT900 *mc); // write and list coverage bitmaps
+void  writeCallPath(ELLIOTT900 *mc, FILE *f, INT32 node); // write chain of calls to context
+INT32 compareCalls(const void *x, const void *y); // order subroutines by inclusive time
 void  printTime(INT64 us);     // print out time counted in microseconds
 void  printAddr(FILE *f, INT32 addr); // print address in m^nnn format
 
-void  movePlotter(INT32 bits); // Move the plotter pen
-void  setupPlotter(void);      // Clear paper to white pixels
-void  savePlotterPaper(void);  // Write paper image to PLOT_FILE
-INT32 readTape();              // read from paper tape
-void  punchTape(INT32 ch);     // punch to paper tape
-INT32 readTTY();               // read from teletype
-void  writeTTY(INT32 ch);      // write to teletype
-void  flushTTY();              // force output of last tty output line
-void  loadII();                // load initial orders
+void  movePlotter(ELLIOTT900 *mc, INT32 bits); // Move the plotter pen
+void  setupPlotter(ELLIOTT900 *mc); // Clear paper to white pixels
+void  savePlotterPaper(ELLIOTT900 *mc); // Write paper image to PLOT_FILE
+INT32 readTape(ELLIOTT900 *mc); // read from paper tape
+void  punchTape(ELLIOTT900 *mc, INT32 ch); // punch to paper tape
+INT32 readTTY(ELLIOTT900 *mc); // read from teletype
+void  writeTTY(ELLIOTT900 *mc, INT32 ch); // write to teletype
+void  flushTTY(ELLIOTT900 *mc); // force output of last tty output line
+void  loadII(ELLIOTT900 *mc);  // load initial orders
 INT32 makeIns(INT32 m, INT32 f, INT32 a); // help for loadII
-void  putTTYOchar(char ch); 
+void  putTTYOchar(ELLIOTT900 *mc, char ch);
 
 
 /**********************************************************/
@@ -273,18 +965,60 @@ void  putTTYOchar(char ch);
 
 
 INT32 main (INT32 argc, const char **argv) {
+   ELLIOTT900 *mc = newMachine(); // machine to be run
+
+   interactive = mc;         // controlled by signals
    signal(SIGINT, catchInt); // allow control-C to end cleanly
    diag = stderr;            // set up diagnostic output for reports
-   decodeArgs(argc, argv);   // decode command line and set options etc
+   decodeArgs(mc, argc, argv); // decode command line and set options etc
 
-   emulate();                // run emulation
+   if ( decodePath != NULL )
+     exit(decodeTrace(decodePath)); // print binary trace instead of running
+   if ( batchPath != NULL )
+     exit(runBatch(mc));     // run batch jobs with these options
+   emulate(mc);              // run emulation
    //***MJB tell main  finished 
 }
 
+// With -batch only flags are set, which each job polls for in pace().
 void catchInt(INT32 sig, void (*handler)(int)) {
-  flushTTY();
+  if   ( batchPath != NULL )
+    {
+      stopping = TRUE;
+      return;
+    }
+  flushTTY(interactive);
   fprintf(stderr, "*** Execution terminated by interrupt\n");
-  tidyExit(EXIT_FAILURE);
+  tidyExit(interactive, EXIT_FAILURE);
+}
+
+void catchPause(INT32 sig) {
+  paused   = ! paused;
+  if ( batchPath == NULL )
+    interactive->paceTime = 0; // make the execution loop call pace() at once
+}
+
+// Access to a guard page following store or decoded, i.e., an address outside
+// of the available store.  Any other fault is left to the default action.
+// Nothing is reported here, as stdio is not safe in a handler: the address
+// is noted and the run abandoned by returning to emulate(), which reports it.
+void catchSegv(INT32 sig, siginfo_t *info, void *context) {
+  ELLIOTT900 *mc = running; // the fault is taken by the thread running mc
+  const char *p = (const char *) info->si_addr;
+  INT32 addr;
+  if   ( mc != NULL && p >= (const char *) (mc->store + STORE_SIZE)
+	 && p < (const char *) (mc->store + STORE_REACH) )
+    addr = (const INT32 *) p - mc->store;
+  else if ( mc != NULL && p >= (const char *) (mc->decoded + STORE_SIZE)
+	    && p < (const char *) (mc->decoded + DECODE_REACH) )
+    addr = (p - (const char *) mc->decoded) / sizeof(DECODED);
+  else
+    {
+      signal(SIGSEGV, SIG_DFL); // genuine fault, re-raised on return
+      return;
+    }
+  mc->faultAddr = addr;
+  siglongjmp(mc->fault, 1);
 }
 
 
@@ -293,44 +1027,91 @@ void catchInt(INT32 sig, void (*handler)(int)) {
 /**********************************************************/
 
 
-void decodeArgs (INT32 argc, const char *argv[])
+void decodeArgs (ELLIOTT900 *mc, INT32 argc, const char *argv[])
 {
   INT32 c;
+  INT32 diagnose, limit; // TRUE => checks needed by the options
   char *buffer = NULL;
   char number[12];
   poptContext optCon;
+  static INT32 (*const runLoops[2][2][2])(ELLIOTT900 *mc) = // indexed by engine, diagnose, limit
+    {
+      { { runSwitch,   runSwitchLimit   }, { runSwitchDiag,   runSwitchFull   } },
+      { { runThreaded, runThreadedLimit }, { runThreadedDiag, runThreadedFull } }
+    };
   struct poptOption optionsTable[] = {
       {"reader",  '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
-       &ptrPath, 0, "paper tape reader input", "file"},
+       &mc->ptrPath, 0, "paper tape reader input", "file"},
       {"punch",   '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
-       &punPath, 0, "paper tape punch output", "file"},
+       &mc->punPath, 0, "paper tape punch output", "file"},
       {"ttyin",   '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
-       &ttyInPath, 0, "teletype input", "file"},
+       &mc->ttyInPath, 0, "teletype input", "file"},
       {"plot",    '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
-       &plotPath, 0, "plotter output", "file"},
+       &mc->plotPath, 0, "plotter output", "file"},
       {"store",   '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
-       &storePath, 0, "store image", "file"},
+       &mc->storePath, 0, "store image", "file"},
+      {"snapshot", '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &mc->snapPath, 0, "write machine state at end", "file"},
+      {"resume",  '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &mc->resumePath, 0, "start from machine state", "file"},
+      {"record",  '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &mc->recordPath, 0, "record input", "file"},
+      {"replay",  '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &mc->replayPath, 0, "replay recorded input", "file"},
       {"dfile",   'd',  POPT_ARG_NONE | POPT_ARGFLAG_ONEDASH,
        0, 1, "diagnostics to file", ""},    
+      {"debug",   'D',  POPT_ARG_NONE | POPT_ARGFLAG_ONEDASH,
+       0, 10, "debug with reverse execution at the stop", ""},
+      {"checkpoint", 'c', POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
+       &checkInterval, 11, "instructions between checkpoints for -debug", "integer"},
+      {"engine",  'e',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
+       &engine, 6, "execution engine (0 = switch, 1 = threaded, 2 = blocks, 3 = native)", "integer"},
+      {"loopstop", 'l', POPT_ARG_NONE | POPT_ARGFLAG_ONEDASH,
+       0, 7, "stop on repeated machine state", ""},
+      {"interrupt", 'I', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &buffer, 15, "device interrupts on level when ready", "device:level"},
       {"abandon", 'a',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
-       &abandon, 0, "abandon after n instructions", "integer"},
+       &mc->abandon, 0, "abandon after n instructions", "integer"},
+      {"batch",   'b',  POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &batchPath, 0, "run jobs listed in file", "file"},
       {"height",  'h',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
-       &plotterPaperHeight, 0, "plotter paper height in steps", "integer"},
+       &mc->plotterPaperHeight, 0, "plotter paper height in steps", "integer"},
       {"jump",    'j',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
-       &opKeys, 2, "jump to address", "integer"},
+       &mc->opKeys, 2, "jump to address", "integer"},
       {"monitor", 'm',  POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
        &buffer, 3, "monitor location", "address"},
       {"Pen", 'p',      POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
-       &plotterPenSize, 4, "plotter pen size in steps", "integer"},
+       &mc->plotterPenSize, 4, "plotter pen size in steps", "integer"},
+      {"btrace",  '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &mc->tracePath, 0, "write traces in binary", "file"},
+      {"decode",  '\0', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &decodePath, 0, "print binary trace as text", "file"},
+      {"break",   'B',  POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &buffer, 14, "stop before address, on the nth hit, when a register compares with value",
+       "address[:n][:A|Q|B op value]"},
+      {"coverage", 'C', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &mc->coverPath, 0, "write bitmaps of words executed, read and written", "file"},
+      {"callgraph", 'g', POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &mc->callPath, 0, "profile subroutine calls, writing folded stacks", "file"},
+      {"profile", 'P',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
+       &profileEvery, 12, "profile addresses, sampling every n us (0 = every instruction)", "integer"},
       {"rtrace",  'r',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
        &diagLimit, 0, "trace 1000 instructions after "
         "first n", "integer"},
       {"start",   's',  POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
        &buffer, 5, "start tracing at location n", "address"},
+      {"speed",   'S',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
+       &speed, 8, "run at n times real speed (0 = unlimited)", "integer"},
       {"trace",   't',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
        &diagCount, 0, "turn on tracing after n instructions", "integer"},
+      {"threads", 'T',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
+       &threads, 9, "worker threads for -batch (0 = one per processor)", "integer"},
+      {"verify",  '\0', POPT_ARG_NONE | POPT_ARGFLAG_ONEDASH,
+       0, 16, "check native code against the block interpreter", ""},
+      {"watch",   'W',  POPT_ARG_STRING | POPT_ARGFLAG_ONEDASH,
+       &buffer, 13, "watch stores into locations, logging, tracing or stopping", "address[-address][:log|trace|stop]"},
       {"width",   'w',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
-       &plotterPaperWidth, 0, "plotter paper width in steps", "integer"},
+       &mc->plotterPaperWidth, 0, "plotter paper width in steps", "integer"},
       {"verbose", 'v',  POPT_ARG_INT | POPT_ARGFLAG_ONEDASH,
        &verbose, 0, "verbosity", "integer"},
       POPT_AUTOHELP
@@ -355,7 +1136,7 @@ void decodeArgs (INT32 argc, const char *argv[])
       break;
 
     case 2: // j address
-      if ( opKeys >= 8192 )
+      if ( mc->opKeys >= 8192 )
 	usage(optCon, EXIT_FAILURE, "can only jump to addresses less than 8192", NULL);
       break;
 
@@ -368,7 +1149,7 @@ void decodeArgs (INT32 argc, const char *argv[])
       break;
 
     case 4: // p plotter pen size
-      if ( plotterPenSize > 12 )
+      if ( mc->plotterPenSize > 12 )
 	usage(optCon, EXIT_FAILURE, "maximum pen size is 12", NULL);
       break;
 
@@ -379,7 +1160,142 @@ void decodeArgs (INT32 argc, const char *argv[])
       if ( diagFrom >= STORE_SIZE )
 	usage(optCon, EXIT_FAILURE, "tracing start address outside store bounds", buffer);
       break;
+
+    case 6: // e execution engine
+      if ( engine < ENGINE_SWITCH || engine > ENGINE_NATIVE )
+	usage(optCon, EXIT_FAILURE, "unknown execution engine", NULL);
+      if ( engine == ENGINE_NATIVE && ! JIT_HOST )
+	usage(optCon, EXIT_FAILURE, "native code engine needs an x86-64 host", NULL);
+      break;
+
+    case 7: // l loop stop detection
+      loopStop = TRUE;
+      break;
+
+    case 8: // S real time pacing
+      if ( speed < 0 )
+	usage(optCon, EXIT_FAILURE, "speed must not be negative", NULL);
+      break;
+
+    case 9: // T batch worker threads
+      if ( threads < 0 )
+	usage(optCon, EXIT_FAILURE, "number of threads must not be negative", NULL);
+      break;
+
+    case 10: // D debug at stop
+      debugStop = TRUE;
+      break;
+
+    case 11: // c checkpoint interval
+      if ( checkInterval <= 0 )
+	usage(optCon, EXIT_FAILURE, "checkpoint interval must be positive", NULL);
+      break;
+
+    case 12: // P profile
+      if ( profileEvery < 0 )
+	usage(optCon, EXIT_FAILURE, "profile interval must not be negative", NULL);
+      break;
+
+    case 13: // W watch address or range, with action
+      {
+	char *action = strchr(buffer, ':');
+	char *to     = strchr(buffer, '-');
+	INT32 from, last, how = WATCH_LOG;
+	if   ( action != NULL )
+	  {
+	    *action++ = '\0';
+	    how = ( strcmp(action, "log")   == 0 ) ? WATCH_LOG   :
+		  ( strcmp(action, "trace") == 0 ) ? WATCH_TRACE :
+		  ( strcmp(action, "stop")  == 0 ) ? WATCH_STOP  : -1;
+	  }
+	if   ( to != NULL ) *to++ = '\0';
+	from = addtoi(buffer);
+	last = ( to != NULL ) ? addtoi(to) : from;
+	if ( from == -1 || last < from || how == -1 )
+	  usage(optCon, EXIT_FAILURE, "malformed watch", buffer);
+	if ( last >= STORE_SIZE )
+	  usage(optCon, EXIT_FAILURE, "watch address outside store bounds", buffer);
+	if ( watchMap == NULL &&
+	     ((watchMap    = calloc(STORE_SIZE / 8, 1)) == NULL ||
+	      (watchAction = calloc(STORE_SIZE, 1)) == NULL) )
+	  {
+	    perror("*** Cannot allocate watchpoints");
+	    exit(EXIT_FAILURE);
+	  }
+	for ( INT32 a = from ; a <= last ; a++ )
+	  {
+	    watchMap[a >> 3] |= 1 << (a & 7);
+	    watchAction[a] = how;
+	  }
+	if ( how == WATCH_STOP ) watchStops = TRUE;
+	break;
+      }
+
+    case 14: // B breakpoint
+      {
+	BREAKPOINT *bp = realloc(breakpoints, (breakCount + 1) * sizeof(BREAKPOINT));
+	char *part = strtok(buffer, ":");
+	if   ( bp == NULL )
+	  {
+	    perror("*** Cannot allocate breakpoints");
+	    exit(EXIT_FAILURE);
+	  }
+	breakpoints = bp;
+	bp = &breakpoints[breakCount++];
+	bp->addr  = addtoi(part);
+	bp->count = 1;
+	bp->reg   = '\0';
+	if ( bp->addr == -1 )
+	  usage(optCon, EXIT_FAILURE, "malformed breakpoint", buffer);
+	if ( bp->addr < REG_LOCS || bp->addr >= STORE_SIZE )
+	  usage(optCon, EXIT_FAILURE, "breakpoint address outside store bounds", buffer);
+	while ( (part = strtok(NULL, ":")) != NULL )
+	  {
+	    char *end;
+	    if   ( isdigit(part[0]) )
+	      {
+		bp->count = strtoll(part, &end, 10);
+		if ( *end != '\0' || bp->count < 1 )
+		  usage(optCon, EXIT_FAILURE, "malformed breakpoint count", part);
+	      }
+	    else if ( strchr("AQB", part[0]) != NULL && part[0] != '\0' )
+	      {
+		const size_t n = strspn(part + 1, "=!<>");
+		bp->reg = part[0];
+		bp->value = strtol(part + 1 + n, &end, 10);
+		if ( n < 1 || n > 2 || end == part + 1 + n || *end != '\0' )
+		  usage(optCon, EXIT_FAILURE, "malformed breakpoint condition", part);
+		strncpy(bp->op, part + 1, n);
+		bp->op[n] = '\0';
+		if ( strstr("= != < <= > >=", bp->op) == NULL || strcmp(bp->op, "!") == 0 )
+		  usage(optCon, EXIT_FAILURE, "malformed breakpoint condition", part);
+	      }
+	    else
+	      usage(optCon, EXIT_FAILURE, "malformed breakpoint", part);
+	  }
+	break;
+      }
+
+    case 15: // I device interrupting
+      {
+	static const char *const devices[DEVICES] =
+	  { "reader", "ttyin", "punch", "ttyout", "plotter" }; // by DEV_ number
+	char *level = strchr(buffer, ':');
+	INT32 device = 0;
+	if   ( level != NULL ) *level++ = '\0';
+	while ( device < DEVICES && strcmp(buffer, devices[device]) != 0 ) device++;
+	if ( device == DEVICES || level == NULL || strlen(level) != 1
+	     || level[0] < '1' || level[0] > '3' )
+	  usage(optCon, EXIT_FAILURE, "malformed interrupt", buffer);
+	interruptLevel[device] = level[0] - '0';
+	interrupting = TRUE;
+	break;
+      }
       
+    case 16: // verify native code
+      verifyNative = TRUE;
+      break;
+
     default:
       fprintf(stderr, "internal error in decodeArgs (%d)\n", c);
       exit(EXIT_FAILURE);
@@ -396,6 +1312,10 @@ void decodeArgs (INT32 argc, const char *argv[])
   
   if ( (buffer = (char *) poptGetArg(optCon)) != NULL ) // check for extra arguments
        usage(optCon, EXIT_FAILURE, "unexpected argument", buffer);
+  if ( batchPath != NULL && speed >= 0 ) // jobs share processors, so cannot keep to the wall clock
+       usage(optCon, EXIT_FAILURE, "-speed cannot be used with", "-batch");
+  if ( verifyNative && engine != ENGINE_NATIVE )
+       usage(optCon, EXIT_FAILURE, "-verify needs", "-engine=3");
 
   poptFreeContext(optCon); // release context
        
@@ -409,23 +1329,104 @@ void decodeArgs (INT32 argc, const char *argv[])
     {
       diagCount = diagFrom = -1; // -r overides -s, -t
     }
+
+  // choose execution loop making only the checks needed by the options
+  diagnose = ( monLoc >= 0 || diagCount >= 0 || diagFrom >= 0 || diagLimit >= 0 ||
+	       (verbose & 8) || profileEvery == 0 || mc->callPath != NULL );
+  limit    = ( mc->abandon >= 0 || diagLimit >= 0 || speed >= 0 || debugStop ||
+	       profileEvery > 0 || watchStops || interrupting || batchPath != NULL );
+  if ( loopStop && diagnose )
+    {
+      loopStop = FALSE; // only made by the block engine
+      if ( verbose & 1 )
+	fprintf(diag, "Tracing, monitoring or profiling requested, loop stops not detected\n");
+    }
+  if ( loopStop && interrupting )
+    {
+      loopStop = FALSE; // a loop may be waiting for an interrupt
+      if ( verbose & 1 )
+	fprintf(diag, "Interrupts requested, loop stops not detected\n");
+    }
+  if ( loopStop && watchMap != NULL )
+    {
+      loopStop = FALSE; // only made by the block engine, which stores unwatched
+      if ( verbose & 1 )
+	fprintf(diag, "Watchpoints set, loop stops not detected\n");
+    }
+  if ( loopStop && engine != ENGINE_NATIVE )
+    engine = ENGINE_BLOCKS; // state is sampled at the start of each block
+  if ( engine >= ENGINE_BLOCKS && watchMap != NULL && ! diagnose )
+    {
+      engine = ENGINE_THREADED; // blocks store without going through emu900ops.h
+      if ( verbose & 1 )
+	fprintf(diag, "Watchpoints set, block engine not used\n");
+    }
+  if ( engine >= ENGINE_BLOCKS && diagnose )
+    {
+      engine = ENGINE_SWITCH; // blocks skip the per instruction checks these need
+      if ( verbose & 1 )
+	fprintf(diag, "Tracing, monitoring or profiling requested, block engine not used\n");
+    }
+  if ( engine >= ENGINE_BLOCKS )
+    runLoop = runBlocks;
+  else
+    runLoop = runLoops[engine][diagnose][limit];
   if  ( verbose & 1 )
      {
 	if ( diag != stderr )
 	  fprintf(diag, "Diagnostic logging directed to %s\n", LOG_FILE);
-        fprintf(diag, "Paper tape will be read from %s\n", ptrPath);
-        fprintf(diag, "Paper tape will be punched to %s\n", punPath);
-        fprintf(diag, "Teletype input will be read from %s\n", ttyInPath);
-        fprintf(diag, "Plotter output will go to %s\n", plotPath);
-	fprintf(diag, "Plotter paper width %d, height %d\n", plotterPaperWidth, plotterPaperHeight);
-	fprintf(diag, "Plotter pen size %d steps\n", plotterPenSize);
-        fprintf(diag, "Store image will be read from %s\n", storePath);
+        fprintf(diag, "Paper tape will be read from %s\n", mc->ptrPath);
+        fprintf(diag, "Paper tape will be punched to %s\n", mc->punPath);
+        fprintf(diag, "Teletype input will be read from %s\n", mc->ttyInPath);
+        fprintf(diag, "Plotter output will go to %s\n", mc->plotPath);
+	fprintf(diag, "Plotter paper width %d, height %d\n", mc->plotterPaperWidth, mc->plotterPaperHeight);
+	fprintf(diag, "Plotter pen size %d steps\n", mc->plotterPenSize);
+        fprintf(diag, "Store image will be read from %s\n", mc->storePath);
+	if ( mc->resumePath != NULL )
+	  fprintf(diag, "Machine state will be restored from %s\n", mc->resumePath);
+	if ( mc->snapPath != NULL )
+	  fprintf(diag, "Machine state will be saved to %s\n", mc->snapPath);
+	if ( mc->recordPath != NULL )
+	  fprintf(diag, "Input will be recorded to %s\n", mc->recordPath);
+	if ( mc->replayPath != NULL )
+	  fprintf(diag, "Input will be replayed from %s\n", mc->replayPath);
+	if ( mc->tracePath != NULL )
+	  fprintf(diag, "Traces will be written in binary to %s\n", mc->tracePath);
+	if ( batchPath != NULL )
+	  fprintf(diag, "Jobs will be read from %s\n", batchPath);
 	fprintf(diag, "Execution will commence at address ");
-	printAddr(diag, opKeys);
-	fprintf(diag," (%d)\n", opKeys);
-        if ( abandon >= 0 )
+	printAddr(diag, mc->opKeys);
+	fprintf(diag," (%d)\n", mc->opKeys);
+	if ( engine == ENGINE_THREADED )
+	  fprintf(diag, "Threaded execution engine selected\n");
+	if ( engine == ENGINE_BLOCKS )
+	  fprintf(diag, "Block translating execution engine selected\n");
+	if ( engine == ENGINE_NATIVE )
+	  fprintf(diag, "Native code execution engine selected\n");
+	if ( engine == ENGINE_NATIVE && verifyNative )
+	  fprintf(diag, "Native code will be verified against the block interpreter\n");
+	if ( loopStop )
+	  fprintf(diag, "Loops with a repeated machine state will be treated as dynamic stops\n");
+	if ( debugStop && batchPath == NULL )
+	  fprintf(diag, "Checkpoints will be taken every %d instructions for debugging\n",
+		  checkInterval);
+	if ( profileEvery == 0 )
+	  fprintf(diag, "Every instruction will be profiled\n");
+	else if ( profileEvery > 0 )
+	  fprintf(diag, "Instructions will be profiled every %d us of simulated time\n",
+		  profileEvery);
+	if ( mc->callPath != NULL )
+	  fprintf(diag, "Subroutine calls will be profiled and written to %s\n",
+		  mc->callPath);
+	if ( mc->coverPath != NULL )
+	  fprintf(diag, "Store coverage will be written to %s\n", mc->coverPath);
+	if ( speed > 0 )
+	  fprintf(diag, "Execution will be paced at %d times real speed\n", speed);
+	else if ( speed == 0 )
+	  fprintf(diag, "Execution will be unpaced, but may be paused\n");
+        if ( mc->abandon >= 0 )
 	  fprintf(diag, "Execution will be abandoned after %d instructions executed\n",
-		    abandon);
+		    mc->abandon);
 	if ( diagCount >= 0 )
 	  fprintf(diag, "Tracing will start after %d instructions executed\n", diagCount);
 	if ( diagFrom >= 0 )
@@ -439,6 +1440,23 @@ void decodeArgs (INT32 argc, const char *argv[])
 	    printAddr(diag, monLoc);
 	    fprintf(diag, " (%d) will be monitored\n", monLoc);
 	  }
+	for ( INT32 i = 0 ; i < breakCount ; i++ )
+	  {
+	    fprintf(diag, "Breakpoint at ");
+	    printAddr(diag, breakpoints[i].addr);
+	    if ( breakpoints[i].count > 1 )
+	      fprintf(diag, " from hit %lld", breakpoints[i].count);
+	    if ( breakpoints[i].reg != '\0' )
+	      fprintf(diag, " when %c %s %d", breakpoints[i].reg, breakpoints[i].op,
+		      breakpoints[i].value);
+	    fputc('\n', diag);
+	  }
+	if ( watchMap != NULL )
+	  {
+	    INT32 n = 0;
+	    for ( INT32 a = 0 ; a < STORE_SIZE ; a++ ) n += (watchMap[a >> 3] >> (a & 7)) & 1;
+	    fprintf(diag, "%d locations will be watched\n", n);
+	  }
        }
 }
 
@@ -474,38 +1492,200 @@ INT32 addtoi (char *s) {
 /**********************************************************/
 
 
-void emulate () {
+// Allocate a machine with its settings at their defaults
+ELLIOTT900 *newMachine ()
+{
+  ELLIOTT900 *mc = aligned_alloc(64, sizeof(ELLIOTT900));
+  if   ( mc == NULL )
+    {
+      perror("*** Cannot allocate machine");
+      exit(EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  memset(mc, 0, sizeof(ELLIOTT900));
+  mc->bReg       = BREGLEVEL(1);
+  mc->scReg      = SCRLEVEL(1);
+  mc->level      = 1;
+  mc->active     = 1 << 1;
+  mc->abandon    = -1;
+  mc->breakAt    = -1; // so that the first instruction can stop at a breakpoint
+  mc->opKeys     = 8181;
+  mc->monLast    = -1;
+  mc->ptrPath    = RDR_FILE;
+  mc->punPath    = PUN_FILE;
+  mc->ttyInPath  = TTYIN_FILE;
+  mc->plotPath   = PLOT_FILE;
+  mc->storePath  = STORE_FILE;
+  mc->stopPath   = STOP_FILE;
+  mc->residuePath = RDR_FILE;
+  mc->ttyoFile   = stdout; // teletype output to stdout
+  mc->lastttych  = -1;
+  mc->punchCount = -1;
+  mc->ttyCount   = -1;
+  mc->blocks     = calloc(STORE_SIZE, sizeof(BLOCK));
+  mc->uops       = calloc(UOP_POOL, sizeof(UOP));
+  mc->loopInterval       = 1;
+  mc->outputTo           = -1;
+  mc->paceTime           = NEVER;
+  mc->plotterPaperWidth  = PAPER_WIDTH;
+  mc->plotterPaperHeight = PAPER_HEIGHT;
+  mc->plotterPenSize     = PEN_SIZE;
+  if   ( mc->blocks == NULL || mc->uops == NULL )
+    {
+      perror("*** Cannot allocate translated blocks");
+      exit(EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  return mc;
+}
+
+// Release machine mc and everything allocated for it
+void freeMachine (ELLIOTT900 *mc)
+{
+  if ( mc->store   != NULL )
+    freeGuarded(mc->store, STORE_SIZE * sizeof(INT32), STORE_REACH * sizeof(INT32));
+  if ( mc->decoded != NULL )
+    freeGuarded(mc->decoded, STORE_SIZE * sizeof(DECODED), DECODE_REACH * sizeof(DECODED));
+  if ( mc->code    != NULL ) freeNative(mc);
+  free(mc->blocks);
+  free(mc->uops);
+  free(mc->plotterPaper);
+  free(mc->checkpoints);
+  free(mc->verifyStates);
+  free(mc->replayLog);
+  free(mc->profile);
+  free(mc->callNodes);
+  free(mc->callStack);
+  free(mc->watchLast);
+  free(mc->breakHits);
+  free(mc->coverage);
+  if ( mc->trace   != NULL ) free(mc->trace->records);
+  free(mc->trace);
+  free(mc);
+}
+
+void emulate (ELLIOTT900 *mc) {
   //***MJB close main Read Pipe
   //***MJB close emu Write pipe
 
 
   INT32 exitCode = EXIT_SUCCESS; // reason for terminating
-  INT32 tracing  = FALSE; // true if tracing enabled
-  INT64 emTime   = 0L; // crude estimate of 900 elapsed time
-
-  FILE *stop; // used to open stopFile
 
   // set up machine ready to execute
-  clearStore();  // start with a cleared store
-  readStore();   // read in store image if available
-  loadII();      // load initial orders
-  ttyoFile = stdout; // teletype output to stdout
-  store[scReg] = opKeys; // set SCR from operator control panel keys
+  allocateStore(mc); // store with guard pages in place of bounds checks
+  clearStore(mc); // start with a cleared store
+  readStore(mc); // read in store image if available
+  loadII(mc);    // load initial orders
+  if   ( engine == ENGINE_NATIVE ) initNative(mc);
+  if   ( mc->replayPath != NULL ) readRecord(mc);
+  if   ( mc->recordPath != NULL ) startRecord(mc);
+  mc->store[mc->scReg] = mc->opKeys; // set SCR from operator control panel keys
+  if   ( mc->resumePath != NULL ) // carry on from a snapshot instead
+    {
+      SNAPSHOT *snap = malloc(sizeof(SNAPSHOT));
+      if   ( snap == NULL )
+	{
+	  perror("*** Cannot allocate snapshot");
+	  stopMachine(mc, EXIT_FAILURE);
+	  /* NOT REACHED */
+	}
+      readSnapshot(mc, snap, mc->resumePath);
+      restoreSnapshot(mc, snap);
+      if   ( mc->punFile != NULL && ftruncate(fileno(mc->punFile), snap->punPos) != 0 )
+	{
+	  fprintf(stderr, "*** Cannot cut back ");
+	  perror(mc->punPath);
+	  stopMachine(mc, EXIT_FAILURE);
+	  /* NOT REACHED */
+	}
+      free(snap);
+      mc->breakAt = mc->iCount; // not stopping again at a breakpoint stopped at
+    }
+  if   ( breakCount > 0 )
+    {
+      if ( (mc->breakHits = calloc(breakCount, sizeof(INT64))) == NULL )
+	{
+	  perror("*** Cannot allocate breakpoints");
+	  stopMachine(mc, EXIT_FAILURE);
+	  /* NOT REACHED */
+	}
+      for ( INT32 i = 0 ; i < breakCount ; i++ )
+	{
+	  mc->decoded[breakpoints[i].addr].brk   = TRUE;
+	  mc->decoded[breakpoints[i].addr].valid = FALSE;
+	}
+    }
   
   if   ( verbose & 1 )
     {
       fprintf(diag,"Starting execution from location ");
-      printAddr(diag, opKeys);
+      printAddr(diag, mc->store[mc->scReg]);
       fputc('\n', diag);
     }
-  if   ( monLoc >= 0 ) monLast = store[monLoc]; // set up monitoring
+  if   ( monLoc >= 0 ) mc->monLast = mc->store[monLoc]; // set up monitoring
+  if   ( watchMap != NULL )
+    {
+      if ( (mc->watchLast = malloc(STORE_SIZE * sizeof(INT32))) == NULL )
+	{
+	  perror("*** Cannot allocate watchpoints");
+	  stopMachine(mc, EXIT_FAILURE);
+	  /* NOT REACHED */
+	}
+      memcpy(mc->watchLast, mc->store, STORE_SIZE * sizeof(INT32));
+    }
+  if   ( speed >= 0 ) startPacing(mc);
+  if   ( profileEvery >= 0 )
+    {
+      if ( (mc->profile = calloc(STORE_SIZE, sizeof(PROFILE))) == NULL )
+	{
+	  perror("*** Cannot allocate profile");
+	  stopMachine(mc, EXIT_FAILURE);
+	  /* NOT REACHED */
+	}
+      mc->profileTime = mc->emTime;
+      mc->profileDue  = mc->emTime + profileEvery; // samples taken by pace()
+      if ( profileEvery > 0 && mc->profileDue < mc->paceTime ) mc->paceTime = mc->profileDue;
+    }
+  if   ( interrupting || mc->batched )
+    mc->paceTime = 0; // pace() finds the events to interrupt on, or polls for signals
+  if   ( mc->tracePath != NULL ) startTrace(mc);
+  if   ( mc->coverPath != NULL
+	 && (mc->coverage = calloc(COVER_KINDS * COVER_BYTES, 1)) == NULL )
+    {
+      perror("*** Cannot allocate coverage bitmaps");
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  if   ( mc->callPath != NULL )
+    {
+      mc->callNodeSize = 256;
+      if ( (mc->callNodes = calloc(mc->callNodeSize, sizeof(CALLNODE))) == NULL ||
+	   (mc->callStack = malloc(CALL_DEPTH * sizeof(CALLFRAME))) == NULL )
+	{
+	  perror("*** Cannot allocate call graph");
+	  stopMachine(mc, EXIT_FAILURE);
+	  /* NOT REACHED */
+	}
+      mc->callNodes[0].entry = -1; // root, for code outside any call
+      mc->callNodes[0].parent = mc->callNodes[0].child = mc->callNodes[0].sibling = -1;
+      mc->callNodeCount = 1;
+      mc->callStack[0].node = 0;
+      mc->callStack[0].ret  = -1;
+      mc->callDepth = 0;
+      mc->callAt    = -1;
+      mc->callTime  = mc->emTime;
+    }
+  if   ( debugStop && ! mc->batched
+	 && (mc->checkpoints = malloc(CHECKPOINTS * sizeof(SNAPSHOT))) == NULL )
+    {
+      perror("*** Cannot allocate checkpoints");
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
 
 
 //*** Main execution loop ***
 
-  // instruction fetch and decode loop
-  while ( ++iCount )
-    {
 // *** MJB update global regvals
 /*
 
@@ -537,363 +1717,1180 @@ void emulate () {
 
 */
 
-      
-      // increment SCR
-      lastSCR = store[scReg];
-      store[scReg]++;
-      checkAddress(lastSCR);
+  // run instructions until a stop condition arises, coming back here from
+  // catchSegv() if the program addresses beyond the available store
+  if   ( sigsetjmp(mc->fault, 1) == 0 )
+    {
+      running  = mc; // for catchSegv()
+      exitCode = ( mc->checkpoints != NULL ) ? runCheckpointed(mc) : runLoop(mc);
+    }
+  else
+    {
+      flushTTY(mc);
+      fprintf(diag, "*** Address outside of available store (%d)\n", mc->faultAddr);
+      tidyExit(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+
+  // execution complete
+  if   ( verbose & 1 ) // print statistics
+    {
+      if ( exitCode == EXIT_LIMITSTOP )
+	fprintf(diag, "Instruction limit reached\n");
+      fprintf(diag, "exit code %d\n", exitCode);
+      fprintf(diag, "Function code count\n");
+      for ( INT32 i = 0 ; i <= 15 ; i++ )
+	{
+	  fprintf(diag, "%4d: %8lld (%3lld%%)",
+		  i, mc->fCount[i], ( mc->iCount > 0 ) ? (mc->fCount[i] * 100L) / mc->iCount : 0);
+	  if  ( ( i % 4) == 3 ) fputc('\n', diag);
+	}
+       fprintf(diag, "%lld instructions executed in ", mc->iCount);
+       printTime(mc->emTime);
+       fprintf(diag, " of simulated time\n");
+       if ( mc->ioWait > 0 )
+	 {
+	   printTime(mc->ioWait);
+	   fprintf(diag, " of it waiting for peripherals\n");
+	 }
+       if ( interrupting )
+	 fprintf(diag, "%lld interrupts taken, ending in level %d\n", mc->interrupts, mc->level);
+       if ( engine >= ENGINE_BLOCKS )
+	 fprintf(diag, "%lld blocks translated, %lld invalidated by stores, "
+		 "%lld idioms fused\n", mc->blocksTranslated, mc->blocksInvalidated, mc->idiomsFused);
+       if ( engine == ENGINE_NATIVE )
+	 fprintf(diag, "%lld blocks compiled to native code\n", mc->blocksCompiled);
+       if ( engine == ENGINE_NATIVE && verifyNative )
+	 fprintf(diag, "%lld runs of compiled blocks verified\n", mc->blocksVerified);
+       if ( speed > 0 )
+	 {
+	   const INT64 drift = wallClock() - (mc->paceWall + (mc->emTime - mc->paceEm) * 1000 / speed);
+	   fprintf(diag, "Paced at %d times real speed, finishing %lld ms %s the wall clock "
+		   "and at most %lld ms behind\n", speed, llabs(drift) / 1000000,
+		   ( drift > 0 ) ? "behind" : "ahead of", mc->paceMaxLag / 1000000);
+	 }
+       if ( mc->idleSkipped != 0 )
+	 fprintf(diag, "%lld instructions of idle loops fast forwarded\n", mc->idleSkipped);
+       if ( mc->countedSkipped != 0 )
+	 fprintf(diag, "%lld instructions of counting loops computed in one step\n",
+		 mc->countedSkipped);
+     }
 
-      // fetch and decode instruction;
-      instruction = store[lastSCR];
-      f = (instruction >> FN_SHIFT) & FN_MASK;
-      a = (instruction & ADDR_MASK) | (lastSCR & MOD_MASK);
-      fCount[f]+=1; // track number of executions of each function code
+  tidyExit(mc, exitCode);
+}
 
-      // perform B modification if needed
-      if ( instruction >= BIT18 )
-        {
-  	  m = (a + store[bReg]) & MASK16;
-	  emTime += 6;
+// Checks made at the end of every instruction.  Returns the exit code if
+// execution is to stop, otherwise -1.  The execution loops pass constant
+// values of diagnose (monitoring and tracing) and limit (instruction limit)
+// so that each gets a copy with only the checks it needs.
+static inline __attribute__((always_inline))
+INT32 endInstruction (ELLIOTT900 *mc, const INT32 diagnose, const INT32 limit)
+{
+  if   ( diagnose )
+    {
+      // check for change on monLoc
+      if   ( monLoc >= 0 && mc->store[monLoc] != mc->monLast )
+	{
+	  fprintf(diag, "Monitored location changed from %d to %d\n",
+	      mc->monLast, mc->store[monLoc]);
+	  mc->monLast = mc->store[monLoc];
+	  mc->traceOne = TRUE;
 	}
-      else
-	  m = a & MASK16;
 
-      // perform function determined by function code f
-      switch ( f )
-        {
+      // profile every instruction
+      if   ( profileEvery == 0 )
+	{
+	  PROFILE *p = &mc->profile[mc->lastSCR];
+	  p->count++;
+	  p->time += mc->emTime - mc->profileTime;
+	  mc->profileTime = mc->emTime;
+	}
+      if   ( mc->callNodes != NULL ) traceCalls(mc);
 
-        case 0: // Load B
-	    checkAddress(m);
-	    qReg = store[m]; store[bReg] = qReg;
-	    emTime += 30;
-	    break;
-
-          case 1: // Add
-       	    aReg = (aReg + store[m]) & MASK18;
-	    emTime += 23;
-	    break;
-
-          case 2: // Negate and add
-	    checkAddress(m);
-	    aReg = (store[m] - aReg) & MASK18;
-	    emTime += 26;
-	    break;
-
-          case 3: // Store Q
-	    checkAddress(m);
-	    store[m] = qReg >> 1;
-	    emTime += 25;
-	    break;
-
-          case 4: // Load A
-	    checkAddress(m);
-	    aReg = store[m];
-	    emTime += 23;
-	    break;
-
-          case 5: // Store A
-	    if   ( level == 1 && m >= 8180 && m <= 8191 )
-	      {
-		if ( verbose & 1 )
-	            fprintf(diag,
-		      "Write to initial instructions ignored in priority level 1");
-	      }
-	    else
-	      {
-		checkAddress(m);
-	        store[m] = aReg;
-	      }
-	    emTime += 25;
-	    break;
+      // check to see if need to start diagnostic tracing
+      if   ( (mc->lastSCR == diagFrom) || ( (diagCount != -1) && (mc->iCount >= diagCount)) )
+	mc->tracing = TRUE;
+      if   ( mc->iCount == diagLimit )
+	{
+	  mc->tracing = TRUE;
+	  mc->abandon = mc->iCount + 1000; // trace 1000 instructions
+	}
 
-          case 6: // Collate
-	    checkAddress(m);
-	    aReg &= store[m];
-	    emTime += 23;
-	    break;
+      // print diagnostics if required
+      if   ( mc->traceOne )
+	{
+	  mc->traceOne = FALSE; // dealt with single case
+	  traceInstruction(mc);
+	}
+      else if ( mc->tracing && (verbose & 4) )
+	traceInstruction(mc);
+    }
 
-          case 7: // Jump if zero
-  	    if   ( aReg == 0 )
-	      {
-	        traceOne = tracing && (verbose & 2);
-	        store[scReg] = m;
-		emTime += 28;
-	      }
-	    if  ( aReg > 0 )
-	      emTime += 21;
-	    else
-	      emTime += 20;
-	    break;
+  // check for limits
+  if   ( limit && (mc->abandon != -1) && (mc->iCount >= mc->abandon) )
+    {
+      flushTTY(mc);
+      return EXIT_LIMITSTOP;
+    }
 
-          case 8: // Jump unconditional
-	    store[scReg] = m;
-	    emTime += 23;
-	    break;
+  // check for dynamic stop, which may be waiting for an interrupt
+  if   ( mc->store[mc->scReg] == mc->lastSCR && ! (interrupting && awaitInterrupt(mc)) )
+    {
+      flushTTY(mc);
+      if   ( verbose & 1 )
+	{
+	  fprintf(diag, "Dynamic stop at ");
+	  printAddr(diag, mc->lastSCR);
+	  fputc('\n', diag);
+	}
+      return writeStop(mc, mc->lastSCR);
+    }
 
-          case 9: // Jump if negative
-	    if   ( aReg >= BIT18 )
-	      {
-	        traceOne = tracing && (verbose & 2);
-		store[scReg] = m;
-		emTime += 25;
-	      }
-	    emTime += 20;
-	    break;
+  // keep in step with the wall clock for "proper" emulation
+  if   ( limit && mc->emTime >= mc->paceTime ) pace(mc);
 
-          case 10: // increment in store
-	    checkAddress(m);
- 	    store[m] = (store[m] + 1) & MASK18;
-	    emTime += 24;
-	    break;
+  return -1;
+}
 
-          case 11:  // Store S
-	    {
-	      qReg = store[scReg] & MOD_MASK;
-	      store[m] = store[scReg] & ADDR_MASK;
-	      emTime += 30;
-	      break;
-	    }
+// Write dynamic stop address to the stop file.  Returns EXIT_DYNSTOP.
+INT32 writeStop (ELLIOTT900 *mc, INT32 addr)
+{
+  FILE *stop; // used to open stopFile
 
-          case 12:  // Multiply
-	    {
-	      checkAddress(m);
-	      {
-	        // extend sign bits for a and store[m]
-	        const INT64 al = (INT64) ( ( aReg >= BIT18 ) ? aReg - BIT19 : aReg );
-	        const INT64 sl = (INT64) ( ( store[m] >= BIT18 ) ? store[m] - BIT19 : store[m] );
-	        INT64  prod = al * sl;
-	        qReg = (INT32) ((prod << 1) & MASK18 );
-	        if   ( al < 0 ) qReg |= 1;
-	        prod = prod >> 17; // arithmetic shift
- 	        aReg = (int) (prod & MASK18);
-	        emTime += 79;
-	        break;
-	      }
-	    }
+  if ( (stop = fopen(mc->stopPath, "w")) == NULL )
+    {
+      fprintf(stderr, ERR_FOPEN_STOP_FILE);
+      perror(mc->stopPath);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
 
-          case 13:  // Divide
-	    {
-	      checkAddress(m);
-	      {
-	        // extend sign bit for aq
-	        const INT64 al   = (INT64) ( ( aReg >= BIT18 ) ? aReg - BIT19 : aReg ); // sign extend
-	        const INT64 ql   = (INT64) qReg;
-	        const INT64 aql  = (al << 18) | ql;
-	        const INT64 ml   = (INT64) ( ( store[m] >= BIT18 ) ? store[m] - BIT19 : store[m] );
-                const INT64 quot = (( aql / ml) >> 1) & MASK18;
-	        const INT32 q     = (INT32) quot;
-  	        aReg = q | 1;
-	        qReg = q & 0777776;
-	        emTime += 79;
-	        break;
-	      }
-	    }
+  fprintf(stop, "%d", addr);
+  fclose(stop);
+  return EXIT_DYNSTOP;
+}
 
-          case 14:  // Shift - assumes >> applied to a signed long or int is arithmetic
-	    {
-              INT32       places = m & ADDR_MASK;
-	      const INT64 al  = (INT64) ( ( aReg >= BIT18 ) ? aReg - BIT19 : aReg ); // sign extend
-	      const INT64 ql  = qReg;
-	      INT64       aql = (al << 18) | ql;
-	      
-	      if   ( places <= 2047 )
-	        {
-		  emTime += (24 + 7 * places);
-	          if   ( places >= 36 ) places = 36;
-	          aql <<= places;
-	        }
-	      else if ( places >= 6144 )
-	        { // right shift is arithmetic
-	          places = 8192 - places;
-		  emTime += (24 + 7 * places);
-	          if ( places >= 36 ) places = 36;
-		  aql >>= places;
-	        }  
-	      else
-	        {
-		  flushTTY();
-	          fprintf(diag, "*** Unsupported i/o 14 i/o instruction\n");
-	          printDiagnostics(instruction, f, a);
-	          tidyExit(EXIT_FAILURE);
-	          /* NOT REACHED */
-	        }
-
-	      qReg = (int) (aql & MASK18);
-	      aReg = (int) ((aql >> 18) & MASK18);
-	      break;
-	    }
+void startPacing (ELLIOTT900 *mc)
+{
+  struct sigaction sa;
 
-            case 15:  // Input/output etc
-	      {
-                const INT32 z = m & ADDR_MASK;
-	        switch   ( z )
-	    	  {
-
-		    case 2048: // read from tape reader
-		      { 
-	                const INT32 ch = readTape(); 
-	                aReg = ((aReg << 7) | ch) & MASK18;
-			emTime += 4000; // assume 250 ch/s reader
-	                break;
-	               }
-
-	            case 2052: // read from teletype
-		      {
-	                const INT32 ch = readTTY();
-	                aReg = ((aReg << 7) | ch) & MASK18;
-			emTime += 100000; // assume 10 ch/s teletype
-	                break;
-	              }
-
-		  case 4864: // send to plotter
-		    
-		      movePlotter(aReg);
-		      if   (aReg >= 16 )
-		      {
-			  emTime += 20000;  // 20ms per step
-		      }
-		      else
-		      {
-			  emTime += 3300;   // 3.3ms
-		      }		  
-		      break;
-
-	            case 6144: // write to paper tape punch 
-	              punchTape(aReg & 255);
-		      emTime += 9091; // assume 110 ch/s punch
-	              break;
-
-	            case 6148: // write to teletype
-	              writeTTY(aReg & 255);
-		      emTime += 100000; // assume 10 ch/s teletype
-	              break;	      
-	  
-	            case 7168:  // Level terminate
-	              level = 4;
-	              scReg = SCRLEVEL4;
-		      bReg  = BREGLEVEL4;
-		      emTime += 19;
-	              break;
-
-	            default:
-		      flushTTY();
-	              fprintf(diag, "*** Unsupported 15 i/o instruction\n");
-	              printDiagnostics(instruction, f, a);
-	              tidyExit(EXIT_FAILURE);
-	              /* NOT REACHED */
-		  } // end 15 switch
-	      } // end case 15
-	} // end function switch
-
-        // check for change on monLoc
-        if   ( monLoc >= 0 && store[monLoc] != monLast )
-	  {
-	    fprintf(diag, "Monitored location changed from %d to %d\n",
-		monLast, store[monLoc]);
-	    monLast = store[monLoc];
-	    traceOne = TRUE;
-          }
-
-        // check to see if need to start diagnostic tracing
-        if   ( (lastSCR == diagFrom) || ( (diagCount != -1) && (iCount >= diagCount)) )
-	    tracing = TRUE;
-        if   ( iCount == diagLimit )
-	  {
-	    tracing = TRUE;
-	    abandon = iCount + 1000; // trace 1000 instructions
-	  }
+  mc->paceWall = wallClock();
+  mc->paceEm   = mc->emTime;
+  mc->paceTime = ( speed > 0 ) ? mc->emTime : NEVER;
 
-        // print diagnostics if required
-        if   ( traceOne )
-	  {
- 	    flushTTY();
-	    traceOne = FALSE; // dealt with single case
-  	    printDiagnostics(instruction, f, a);
-          }
-	else if ( tracing && (verbose & 4) )
-	  {
-	    flushTTY();
-	    printDiagnostics(instruction, f, a);
-	  }
-	  
-	// check for limits
-        if   ( (abandon != -1) && (iCount >= abandon) )
-        {
-	  flushTTY();
-          if  ( verbose & 1 ) fprintf(diag, "Instruction limit reached\n");
-          exitCode = EXIT_LIMITSTOP;
-  	  break;
-        }
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = catchPause;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+}
 
-        // check for dynamic stop
-        if   ( store[scReg] == lastSCR ) 
-	  {
-	    flushTTY();
-	    if   ( verbose & 1 )
-	      {
-	        fprintf(diag, "Dynamic stop at ");
-	        printAddr(diag, lastSCR);
-	         fputc('\n', diag);
-	       }
-	    if ( (stop = fopen(STOP_FILE, "w")) == NULL )
-	      {
-		fprintf(stderr, ERR_FOPEN_STOP_FILE);
-		perror(STOP_FILE);
-		exit(EXIT_FAILURE);
-		/* NOT REACHED */
-	      }
+// Called when emTime reaches paceTime.  Sleeps until the wall clock catches
+// up with emulated time once it is a batch or more behind, then arranges to
+// be called again after a further batch of emulated time.  Waits out any
+// pause, moving the start of pacing on by its length.  Also takes the
+// samples of a sampled profile.  A batch job is called at least every
+// BATCH_POLL, and ends here if the batch is stopped by SIGINT.
+void pace (ELLIOTT900 *mc)
+{
+  INT64 now = wallClock();
 
-	    fprintf(stop, "%d", lastSCR);
-	    fclose(stop);
-	    exitCode = EXIT_DYNSTOP;
-	    break;
-	  }
-// ***MJB put in 10 microsecond delay for "proper" emulation 
-    } // end while fetching and decoding instructions
+  if   ( paused )
+    {
+      const INT64 pausedAt = now;
+      flushTTY(mc);
+      fflush(stdout);
+      if ( verbose & 1 ) fprintf(diag, "Paused\n");
+      while ( paused && ! stopping ) sleepFor(PAUSE_POLL);
+      now = wallClock();
+      mc->paceWall += now - pausedAt;
+      if ( verbose & 1 && ! stopping ) fprintf(diag, "Resumed\n");
+    }
 
-  // execution complete
-  if   ( verbose & 1 ) // print statistics
+  if   ( stopping )
     {
-      fprintf(diag, "exit code %d\n", exitCode);
-      fprintf(diag, "Function code count\n");
-      for ( INT32 i = 0 ; i <= 15 ; i++ )
+      flushTTY(mc);
+      fprintf(diag, "*** Execution terminated by interrupt\n");
+      tidyExit(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+
+  if   ( interrupting ) takeInterrupt(mc);
+
+  if   ( speed > 0 )
+    {
+      const INT64 due = mc->paceWall + (mc->emTime - mc->paceEm) * 1000 / speed; // in ns
+      if   ( due - now >= PACE_BATCH )
+	sleepFor(due - now);
+      else if ( now - due > mc->paceMaxLag )
+	mc->paceMaxLag = now - due;
+      mc->paceTime = mc->emTime + PACE_BATCH / 1000 * speed;
+    }
+  else
+    mc->paceTime = ( mc->batched ) ? mc->emTime + BATCH_POLL : NEVER;
+
+  // sampled profile, crediting every interval passed to the last instruction
+  if   ( profileEvery > 0 )
+    {
+      for ( ; mc->emTime >= mc->profileDue ; mc->profileDue += profileEvery )
 	{
-	  fprintf(diag, "%4d: %8lld (%3lld%%)",
-		  i, fCount[i], (fCount[i] * 100L) / iCount);
-	  if  ( ( i % 4) == 3 ) fputc('\n', diag);
+	  mc->profile[mc->lastSCR].count++;
+	  mc->profile[mc->lastSCR].time += profileEvery;
 	}
-       fprintf(diag, "%lld instructions executed in ", iCount);
-       printTime(emTime);
-       fprintf(diag, " of simulated time\n");
-     }
+      if ( mc->profileDue < mc->paceTime ) mc->paceTime = mc->profileDue;
+    }
 
-  tidyExit(exitCode);
+  // devices becoming ready may request interrupts
+  if   ( interrupting )
+    for ( INT32 i = 0 ; i < mc->eventCount ; i++ )
+      if ( interruptLevel[mc->events[i].type - EVENT_READY] > 0
+	   && mc->events[i].time < mc->paceTime )
+	mc->paceTime = mc->events[i].time;
 }
 
-void checkAddress(INT32 addr)
+INT64 wallClock ()
 {
-  if   ( addr >= STORE_SIZE )
-        {
-	  flushTTY();
-          fprintf(diag, "*** Address outside of available store (%d)\n", addr);
-  	  tidyExit(EXIT_FAILURE);
-        }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
+void sleepFor (INT64 ns)
+{
+  struct timespec ts;
+  ts.tv_sec  = ns / 1000000000L;
+  ts.tv_nsec = ns % 1000000000L;
+  nanosleep(&ts, NULL);
+}
 
-/**********************************************************/
-/*              STORE DUMP AND RECOVERY                   */
-/**********************************************************/
-
- 
-void clearStore() {
-  for ( INT32 i = 0 ; i < STORE_SIZE ; i++ ) store[i] = 0;
-  if  ( verbose & 1 )
+// Sample the machine state for -loopstop.  The state is saved after 1, 2, 4,
+// 8, ... further samples, so a loop of any length is found by the time the
+// interval reaches its length.  Returns EXIT_DYNSTOP if the current state
+// matches the saved one, otherwise -1.
+INT32 checkLoop (ELLIOTT900 *mc)
+{
+  LOOPSTATE now;
+
+  memset(&now, 0, sizeof(now)); // no stray padding to compare
+  now.aReg        = mc->aReg;
+  now.qReg        = mc->qReg;
+  now.bValue      = mc->store[mc->bReg];
+  now.scrValue    = mc->store[mc->scReg];
+  now.scReg       = mc->scReg;
+  now.level       = mc->level;
+  now.storeWrites = mc->storeWrites;
+  now.ioCount     = mc->ioCount;
+
+  if   ( mc->loopHaveSaved && memcmp(&now, &mc->loopSaved, sizeof(now)) == 0 )
+    {
+      flushTTY(mc);
+      if   ( verbose & 1 )
+	{
+	  fprintf(diag, "Dynamic loop stop at ");
+	  printAddr(diag, now.scrValue);
+	  fputc('\n', diag);
+	}
+      return writeStop(mc, now.scrValue);
+    }
+  if   ( ++mc->loopSamples >= mc->loopInterval )
+    {
+      mc->loopSaved     = now;
+      mc->loopHaveSaved = TRUE;
+      mc->loopInterval *= 2;
+      mc->loopSamples   = 0;
+    }
+  return -1;
+}
+
+// Instruction execution loops, one per engine and set of checks made
+#define RUN_NAME     runSwitch
+#define RUN_THREADED 0
+#define RUN_STEP     0
+#define RUN_DIAG     0
+#define RUN_LIMIT    0
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+#define RUN_NAME     runSwitchLimit
+#define RUN_THREADED 0
+#define RUN_STEP     0
+#define RUN_DIAG     0
+#define RUN_LIMIT    1
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+#define RUN_NAME     runSwitchDiag
+#define RUN_THREADED 0
+#define RUN_STEP     0
+#define RUN_DIAG     1
+#define RUN_LIMIT    0
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+#define RUN_NAME     runSwitchFull
+#define RUN_THREADED 0
+#define RUN_STEP     0
+#define RUN_DIAG     1
+#define RUN_LIMIT    1
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+#define RUN_NAME     runThreaded
+#define RUN_THREADED 1
+#define RUN_STEP     0
+#define RUN_DIAG     0
+#define RUN_LIMIT    0
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+#define RUN_NAME     runThreadedLimit
+#define RUN_THREADED 1
+#define RUN_STEP     0
+#define RUN_DIAG     0
+#define RUN_LIMIT    1
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+#define RUN_NAME     runThreadedDiag
+#define RUN_THREADED 1
+#define RUN_STEP     0
+#define RUN_DIAG     1
+#define RUN_LIMIT    0
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+#define RUN_NAME     runThreadedFull
+#define RUN_THREADED 1
+#define RUN_STEP     0
+#define RUN_DIAG     1
+#define RUN_LIMIT    1
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+// single step for the block engine, which is never used with diagnostics
+#define RUN_NAME     stepSwitch
+#define RUN_THREADED 0
+#define RUN_STEP     1
+#define RUN_DIAG     0
+#define RUN_LIMIT    1
+#include "emu900run.h"
+#undef  RUN_NAME
+#undef  RUN_THREADED
+#undef  RUN_STEP
+#undef  RUN_DIAG
+#undef  RUN_LIMIT
+
+// Execution loop using translated blocks.  Falls back to single steps of
+// the switch engine for code in the register locations or beyond the
+// store, at breakpoints, which are never translated, and when a whole block
+// would overrun the instruction limit or could reach paceTime before its
+// last instruction, so that pace() and any interrupt it takes come after
+// the same instruction as with the other engines.
+INT32 runBlocks (ELLIOTT900 *mc)
+{
+  INT32 exitCode;
+
+  while ( TRUE )
+    {
+      const INT32 start = mc->store[mc->scReg];
+
+      if   ( loopStop && (exitCode = checkLoop(mc)) >= 0 ) return exitCode;
+      if   ( start >= REG_LOCS && start < STORE_SIZE )
+	{
+	  BLOCK *blk = &mc->blocks[start];
+	  if ( ! blk->valid ) translate(mc, start);
+	  if ( blk->valid && (mc->abandon == -1 || mc->iCount + blk->length <= mc->abandon)
+	       && mc->emTime + blk->maxTime < mc->paceTime )
+	    {
+	      const INT32 lastA = mc->aReg, lastQ = mc->qReg;
+	      const INT64 lastTime = mc->emTime;
+	      if ( engine == ENGINE_NATIVE && blk->native == NULL
+		   && ++blk->hits >= JIT_THRESHOLD )
+		compileBlock(mc, blk, start);
+	      mc->inBlock = blk;
+	      if ( blk->native != NULL )
+		exitCode = runNative(mc, blk, start);
+	      else
+		exitCode = runBlock(mc, blk, start);
+	      if ( exitCode >= 0 ) return exitCode;
+
+	      // a pure block returning to itself with A and Q unchanged will
+	      // repeat exactly until something external intervenes
+	      if ( blk->pure && mc->store[mc->scReg] == start && mc->aReg == lastA && mc->qReg == lastQ
+		   && (mc->abandon != -1 || mc->paceTime != NEVER) && blk->valid && ! loopStop )
+		skipIdle(mc, blk, mc->emTime - lastTime);
+	      else if ( blk->counted && mc->store[mc->scReg] == start && blk->valid )
+		skipCounted(mc, blk);
+	      continue;
+	    }
+	}
+      if ( (exitCode = stepSwitch(mc)) >= 0 ) return exitCode;
+    }
+}
+
+// Account for all the iterations of an idle loop of blk, each taking time,
+// that can complete before the next event.  Devices becoming ready only
+// matter to i/o instructions and to interrupts, which pace() takes, so the
+// events to come are the instruction limit and paceTime, which is brought
+// forward to the next interrupt.  Without either the loop runs for ever,
+// so is left to run.  At least the last instruction before the first is
+// left to run normally, so that it stops execution or calls pace().
+void skipIdle (ELLIOTT900 *mc, BLOCK *blk, INT64 time)
+{
+  const INT64 paceTime = mc->paceTime;
+  INT64 iterations = ( mc->abandon != -1 ) ? (mc->abandon - mc->iCount - 1) / blk->length
+                                           : INT64_MAX;
+
+  if ( time > 0 && paceTime != NEVER && (paceTime - 1 - mc->emTime) / time < iterations )
+    iterations = (paceTime - 1 - mc->emTime) / time;
+  if ( iterations <= 0 || iterations == INT64_MAX ) return;
+  mc->iCount += iterations * blk->length;
+  mc->emTime += iterations * time;
+  for ( INT32 i = 0 ; i < blk->codes ; i++ )
+    mc->fCount[blk->code[i]] += iterations * blk->codeCount[i];
+  mc->idleSkipped += iterations * blk->length;
+}
+
+// Account for the iterations of counting loop blk, which has just jumped
+// back leaving its count x negative, that can complete before the next
+// event.  Each adds 1 to x and leaves x in A, storing nowhere else, so
+// iterations up to the one taking x to 0 jump back and take the same time.
+// That last one, and at least the last instruction before the instruction
+// limit or paceTime, are left to run normally.
+void skipCounted (ELLIOTT900 *mc, BLOCK *blk)
+{
+  const INT32 x    = blk->ops[0].a & MASK16;
+  const INT64 time = blk->ops[2].time + 25; // jump taken
+  INT64 iterations = BIT19 - 1 - mc->store[x];
+
+  if ( mc->abandon != -1 && (mc->abandon - mc->iCount - 1) / blk->length < iterations )
+    iterations = (mc->abandon - mc->iCount - 1) / blk->length;
+  if ( (mc->paceTime - 1 - mc->emTime) / time < iterations )
+    iterations = (mc->paceTime - 1 - mc->emTime) / time;
+  if ( iterations <= 0 ) return;
+
+  mc->aReg = mc->store[x] += iterations;
+  mc->storeWrites += iterations;
+  mc->iCount += iterations * blk->length;
+  mc->emTime += iterations * time;
+  mc->fCount[10] += iterations;
+  mc->fCount[4]  += iterations;
+  mc->fCount[9]  += iterations;
+  mc->countedSkipped += iterations * blk->length;
+}
+
+// Execute block starting at pc.  Leaves the block early if a store
+// invalidates it or changes SCR, then makes the end of instruction checks
+// for the last instruction executed.
+INT32 runBlock (ELLIOTT900 *mc, BLOCK *blk, INT32 pc)
+{
+  return finishBlock(mc, blk, interpretBlock(mc, blk, pc));
+}
+
+const UOP *interpretBlock (ELLIOTT900 *mc, BLOCK *blk, INT32 pc)
+{
+  const UOP *op  = blk->ops;
+  const UOP *end = op + blk->length;
+  const INT64 startCount = mc->iCount;
+
+  do
+    {
+      // idioms, whose checks in fuse() ensure they run as if one at a time
+      switch ( op->fuse )
+	{
+	case FUSE_LOAD_ADD:
+	  mc->aReg = (mc->store[op[0].a] + mc->store[op[1].a]) & MASK18;
+	  mc->store[mc->m = op[2].a] = mc->aReg;
+	  pc += 3; op += 3;
+	  mc->lastSCR = pc - 1;
+	  mc->store[mc->scReg] = pc;
+	  INVALIDATE(mc->m);
+	  continue;
+
+	case FUSE_INC_TEST:
+	  mc->m = op[0].a;
+	  mc->aReg = mc->store[mc->m] = (mc->store[mc->m] + 1) & MASK18;
+	  INVALIDATE(mc->m);
+	  pc += 3;
+	  mc->lastSCR = pc - 1;
+	  mc->store[mc->scReg] = pc;
+	  if   ( op[2].f == 7 ? mc->aReg == 0 : mc->aReg >= BIT18 )
+	    {
+	      mc->store[mc->scReg] = op[2].a;
+	      mc->emTime += ( op[2].f == 7 ) ? 28 : 25;
+	    }
+	  else if ( op[2].f == 7 )
+	    mc->emTime += 1; // 21us rather than 20us when positive
+	  op += 3;
+	  continue;
+
+	case FUSE_SHIFT_STORE:
+	  {
+	    INT32       places = op[0].a & ADDR_MASK;
+	    const INT64 al  = (INT64) ( ( mc->aReg >= BIT18 ) ? mc->aReg - BIT19 : mc->aReg );
+	    INT64       aql = (al << 18) | mc->qReg;
+	    if   ( places <= 2047 )
+	      {
+		mc->emTime += (24 + 7 * places);
+		aql <<= ( places >= 36 ) ? 36 : places;
+	      }
+	    else
+	      {
+		places = 8192 - places;
+		mc->emTime += (24 + 7 * places);
+		aql >>= ( places >= 36 ) ? 36 : places;
+	      }
+	    mc->qReg = (INT32) (aql & MASK18);
+	    mc->aReg = (INT32) ((aql >> 18) & MASK18);
+	    mc->store[mc->m = op[1].a] = mc->aReg;
+	    pc += 2; op += 2;
+	    mc->lastSCR = pc - 1;
+	    mc->store[mc->scReg] = pc;
+	    INVALIDATE(mc->m);
+	    continue;
+	  }
+	}
+
+      mc->lastSCR = pc++;
+      mc->store[mc->scReg] = pc;
+      mc->instruction = op->instruction;
+      mc->f = op->f;
+      mc->a = op->a;
+
+      // perform B modification if needed
+      if ( op->bMod )
+	mc->m = (mc->a + mc->store[mc->bReg]) & MASK16;
+      else
+	mc->m = mc->a & MASK16;
+      op++;
+
+      // perform function determined by function code f
+      switch ( mc->f )
+	{
+#define RUN_CASE(n) case n
+#define RUN_NEXT    break
+#define RUN_TIME(n)
+#define RUN_SYNC    accountBlock(mc, blk, op, TRUE)
+#define RUN_COUNT   (startCount + (op - blk->ops))
+#define RUN_PENDING op[-1].time
+#include "emu900ops.h"
+#undef  RUN_CASE
+#undef  RUN_NEXT
+#undef  RUN_TIME
+#undef  RUN_SYNC
+#undef  RUN_COUNT
+#undef  RUN_PENDING
+	}
+    }
+  while ( op < end && blk->valid && mc->store[mc->scReg] == pc );
+
+  return op;
+}
+
+// Execute compiled block starting at pc.  The compiled code leaves SCR set
+// for the next instruction, as runBlock() does.
+INT32 runNative (ELLIOTT900 *mc, BLOCK *blk, INT32 pc)
+{
+  INT32 executed;
+
+  if ( verifyNative ) return verifyBlock(mc, blk, pc);
+  executed = blk->native();
+  mc->lastSCR = pc + executed - 1;
+  return finishBlock(mc, blk, blk->ops + executed);
+}
+
+// Execute blk starting at pc through runBlock(), then, unless it has i/o or
+// stored into itself, again from the same state as compiled code, ending
+// the run if the two leave the machine in different states.  The fields
+// finishBlock() sets are set alike before comparing.
+INT32 verifyBlock (ELLIOTT900 *mc, BLOCK *blk, INT32 pc)
+{
+  const UOP *op;
+  INT32 executed;
+
+  if   ( mc->verifyStates == NULL
+	 && (mc->verifyStates = malloc(2 * sizeof(SNAPSHOT))) == NULL )
+    {
+      perror("*** Cannot allocate states to verify native code");
+      tidyExit(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  takeSnapshot(mc, &mc->verifyStates[0]);
+  op = interpretBlock(mc, blk, pc);
+  if ( blk->ops[blk->length - 1].f == 15 || ! blk->valid )
+    return finishBlock(mc, blk, op); // cannot be repeated
+
+  mc->instruction = op[-1].instruction;
+  mc->f           = op[-1].f;
+  mc->a           = op[-1].a;
+  takeSnapshot(mc, &mc->verifyStates[1]);
+  {
+    const INT32 haveSaved = mc->loopHaveSaved; // kept over the repeat for -loopstop
+    const INT64 interval = mc->loopInterval, samples = mc->loopSamples;
+    restoreSnapshot(mc, &mc->verifyStates[0]);
+    mc->loopHaveSaved = haveSaved;
+    mc->loopInterval  = interval;
+    mc->loopSamples   = samples;
+  }
+  executed = blk->native();
+  mc->lastSCR     = pc + executed - 1;
+  mc->instruction = blk->ops[executed - 1].instruction;
+  mc->f           = blk->ops[executed - 1].f;
+  mc->a           = blk->ops[executed - 1].a;
+  takeSnapshot(mc, &mc->verifyStates[0]);
+  if   ( blk->ops + executed != op
+	 || memcmp(&mc->verifyStates[0], &mc->verifyStates[1], sizeof(SNAPSHOT)) != 0 )
+    {
+      const SNAPSHOT *n = &mc->verifyStates[0], *b = &mc->verifyStates[1];
+      INT32 addr = 0;
+      while ( addr < STORE_SIZE && n->store[addr] == b->store[addr] ) addr++;
+      flushTTY(mc);
+      fprintf(diag, "*** Native code for block at ");
+      printAddr(diag, pc);
+      fprintf(diag, " differs from the block interpreter after %lld instructions\n"
+	      "    native:      %d micro-ops, A %d, Q %d, SCR %d, time %lld, %lld stores",
+	      mc->iCount, executed, n->aReg, n->qReg, n->store[n->scReg], n->emTime,
+	      n->storeWrites);
+      fprintf(diag, "\n    interpreter: %d micro-ops, A %d, Q %d, SCR %d, time %lld, %lld stores",
+	      (INT32) (op - blk->ops), b->aReg, b->qReg, b->store[b->scReg], b->emTime,
+	      b->storeWrites);
+      if ( addr < STORE_SIZE )
+	{
+	  fprintf(diag, "\n    first store difference at ");
+	  printAddr(diag, addr);
+	  fprintf(diag, ": native %d, interpreter %d", n->store[addr], b->store[addr]);
+	}
+      fputc('\n', diag);
+      tidyExit(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  mc->blocksVerified++;
+  return finishBlock(mc, blk, op);
+}
+
+// Account for the micro-ops of blk executed up to op, then make the end of
+// instruction checks for the last of them, which compiled code and idioms
+// leave to set the instruction last executed.
+INT32 finishBlock (ELLIOTT900 *mc, BLOCK *blk, const UOP *op)
+{
+  mc->instruction = op[-1].instruction;
+  mc->f           = op[-1].f;
+  mc->a           = op[-1].a;
+  accountBlock(mc, blk, op, FALSE);
+  return endInstruction(mc, FALSE, TRUE);
+}
+
+// Add the instruction and function code counts and fixed time of the
+// micro-ops of blk executed up to op, and mark their coverage.  cut is TRUE
+// when the last of them is cut short by an error ending the run, which as in
+// the interpreter leaves out its function time but not its B modification.
+// As the engines keep iCount at the start of the block while running it,
+// this is done once, by finishBlock(), by RUN_SYNC before an error is
+// reported or by tidyExit() for a run ended in the block without one.
+void accountBlock (ELLIOTT900 *mc, BLOCK *blk, const UOP *op, INT32 cut)
+{
+  const UOP *end = blk->ops + blk->length;
+
+  mc->inBlock = NULL;
+  mc->iCount += op - blk->ops;
+  mc->emTime += op[-1].time - ( cut ? fnTime[op[-1].f] : 0 );
+  if   ( op == end )
+    for ( INT32 i = 0 ; i < blk->codes ; i++ )
+      mc->fCount[blk->code[i]] += blk->codeCount[i];
+  else
+    for ( const UOP *p = blk->ops ; p < op ; p++ )
+      mc->fCount[p->f]+=1;
+  if ( mc->coverage != NULL && ! blk->covered ) coverBlock(mc, blk, op);
+}
+
+void translate (ELLIOTT900 *mc, INT32 start)
+{
+  BLOCK *blk  = &mc->blocks[start];
+  INT32  addr = start;
+  INT32  time = 0, count[16];
+  INT64  shifts = 0; // most time the shifts translated can take
+
+  if ( mc->decoded[start].brk ) return; // stepped, to check the breakpoint
+  if ( mc->uopsUsed + BLOCK_MAX > UOP_POOL ) flushBlocks(mc); // pool exhausted
+  blk->ops    = &mc->uops[mc->uopsUsed];
+  blk->length = 0;
+  blk->native = NULL;
+  blk->hits   = 0;
+  blk->covered = FALSE;
+  memset(count, 0, sizeof(count));
+  while ( addr < STORE_SIZE && blk->length < BLOCK_MAX && ! mc->decoded[addr].brk )
+    {
+      UOP *op;
+      if ( ! mc->decoded[addr].valid ) decode(mc, addr);
+      if ( mc->coverage != NULL && (mc->decoded[addr].bMod || mc->decoded[addr].f == 0
+				    || COVER_BY_LEVEL(mc->decoded[addr].f,
+						      mc->decoded[addr].a & MASK16)) )
+	break; // stepped, to mark the words it addresses each time
+      op = &blk->ops[blk->length++];
+      blk->maxTime = time + shifts; // instructions before op, which jump only at the end
+      op->instruction = mc->decoded[addr].instruction;
+      op->a           = mc->decoded[addr].a;
+      op->f           = mc->decoded[addr].f;
+      op->bMod        = mc->decoded[addr].bMod;
+      op->fuse        = FUSE_NONE;
+      op->time        = (time += fnTime[op->f] + ( op->bMod ? 6 : 0 ));
+      if   ( op->f == 14 )
+	{
+	  const INT32 places = op->a & ADDR_MASK;
+	  shifts += ( op->bMod ) ? SHIFT_MAX_TIME
+	            : 24 + 7 * ( ( places <= 2047 ) ? places : 8192 - places );
+	}
+      count[op->f]++;
+      mc->decoded[addr++].inBlock = TRUE;
+      if ( (op->f >= 7 && op->f <= 9) || op->f == 15 ) break; // jump or i/o
+    }
+  if ( blk->length == 0 ) return; // first instruction stepped
+  blk->pure  = ( count[0] + count[3] + count[5] + count[10] + count[11] + count[15] == 0 );
+  blk->codes = 0;
+  for ( INT32 i = 0 ; i <= 15 ; i++ )
+    if ( count[i] != 0 )
+      {
+	blk->code[blk->codes]        = i;
+	blk->codeCount[blk->codes++] = count[i];
+      }
+  mc->uopsUsed  += blk->length;
+  blk->valid = TRUE;
+  mc->blocksTranslated++;
+  fuse(mc, blk, start);
+}
+
+// Mark idioms in block starting at start for runBlock() to execute as
+// single macro-ops.  An idiom must not store into the instructions it is
+// made of, nor into the initial instructions, writes to which depend on the
+// priority level.  A block which is just an increment and test jumping back
+// to itself is marked as a counting loop.
+void fuse (ELLIOTT900 *mc, BLOCK *blk, INT32 start)
+{
+  UOP *op = blk->ops;
+
+  for ( INT32 i = 0 ; i < blk->length ; i++ )
+    {
+      const INT32 left = blk->length - i;
+      if   ( left >= 3 && FUSIBLE(op[i], 4) && FUSIBLE(op[i+1], 1) && FUSIBLE(op[i+2], 5)
+	     && ( op[i+2].a < 8180 || op[i+2].a > 8191 ) )
+	op[i].fuse = FUSE_LOAD_ADD;
+      else if ( left >= 3 && FUSIBLE(op[i], 10) && FUSIBLE(op[i+1], 4)
+		&& op[i+1].a == op[i].a && ( op[i+2].f == 7 || op[i+2].f == 9 )
+		&& ! op[i+2].bMod
+		&& op[i].a != start + i + 1 && op[i].a != start + i + 2 )
+	op[i].fuse = FUSE_INC_TEST;
+      else if ( left >= 2 && op[i].f == 14 && ! op[i].bMod && FUSIBLE(op[i+1], 5)
+		&& ( (op[i].a & ADDR_MASK) <= 2047 || (op[i].a & ADDR_MASK) >= 6144 )
+		&& ( op[i+1].a < 8180 || op[i+1].a > 8191 ) )
+	op[i].fuse = FUSE_SHIFT_STORE;
+      else
+	continue;
+      mc->idiomsFused++;
+      i += ( op[i].fuse == FUSE_SHIFT_STORE ) ? 1 : 2;
+    }
+  blk->counted = ( blk->length == 3 && op[0].fuse == FUSE_INC_TEST
+		   && op[2].f == 9 && op[2].a == start );
+}
+
+void invalidateBlocks (ELLIOTT900 *mc, INT32 addr)
+{
+  for ( INT32 start = ( addr >= BLOCK_MAX ) ? addr - BLOCK_MAX + 1 : 0 ; start <= addr ; start++ )
+    if ( mc->blocks[start].valid && start + mc->blocks[start].length > addr )
+      {
+	mc->blocks[start].valid = FALSE;
+	mc->blocksInvalidated++;
+      }
+  mc->decoded[addr].inBlock = FALSE;
+}
+
+void flushBlocks (ELLIOTT900 *mc)
+{
+  for ( INT32 i = 0 ; i < STORE_SIZE ; i++ )
+    {
+      mc->blocks[i].valid = FALSE;
+      mc->decoded[i].inBlock = FALSE;
+    }
+  mc->uopsUsed = 0;
+}
+
+#include "emu900jit.h"
+
+// Allocate store and decoded so that they are followed by inaccessible guard
+// pages covering every address an instruction can form.  Running off the end
+// of the available store then raises SIGSEGV, caught by catchSegv(), and the
+// execution loops need make no bounds checks.
+void allocateStore(ELLIOTT900 *mc)
+{
+  struct sigaction sa;
+
+  mc->store   = allocateGuarded(STORE_SIZE * sizeof(INT32), STORE_REACH * sizeof(INT32));
+  mc->decoded = allocateGuarded(STORE_SIZE * sizeof(DECODED), DECODE_REACH * sizeof(DECODED));
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = catchSegv;
+  sa.sa_flags     = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, NULL);
+}
+
+// Reserve reach bytes of inaccessible pages and make the used bytes ending
+// on a page boundary accessible, returning the start of the used bytes.
+void *allocateGuarded(size_t used, size_t reach)
+{
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t head = (used + page - 1) / page * page; // used rounded up to pages
+  char *base = mmap(NULL, head - used + reach, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if   ( base == MAP_FAILED || mprotect(base, head, PROT_READ | PROT_WRITE) != 0 )
+    {
+      perror("*** Cannot allocate store");
+      exit(EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  return base + head - used;
+}
+
+// Release space p returned by allocateGuarded(used, reach)
+void freeGuarded(void *p, size_t used, size_t reach)
+{
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const size_t head = (used + page - 1) / page * page;
+  munmap((char *) p - (head - used), head - used + reach);
+}
+
+void decode(ELLIOTT900 *mc, INT32 addr)
+{
+  DECODED *d = &mc->decoded[addr];
+  d->instruction = mc->store[addr];
+  d->f     = (d->instruction >> FN_SHIFT) & FN_MASK;
+  d->a     = (d->instruction & ADDR_MASK) | (addr & MOD_MASK);
+  d->bMod  = ( d->instruction >= BIT18 );
+  // SCR and B change on every instruction, and coverInstruction() makes
+  // the entry valid once the instruction is marked
+  d->valid = ( addr >= REG_LOCS && ! d->brk && mc->coverage == NULL );
+}
+
+
+/**********************************************************/
+/*                       BATCH JOBS                       */
+/**********************************************************/
+
+
+// Run every job listed in the file given by -batch on a pool of worker
+// threads, each job on a machine of its own set up with the options in
+// settings.  Prints a summary of the jobs in the order listed and returns
+// EXIT_FAILURE if any job failed, otherwise EXIT_SUCCESS.
+INT32 runBatch (ELLIOTT900 *settings)
+{
+  JOB *jobs;
+  const INT32 count = readJobs(&jobs);
+  const INT64 started = wallClock();
+  INT32 failed = 0, unstarted = 0;
+  INT64 iTotal = 0;
+  struct sigaction sa;
+
+  batchSettings = settings;
+  batchDiag     = diag;
+  workerCount   = ( threads > 0 ) ? threads : sysconf(_SC_NPROCESSORS_ONLN);
+  if ( workerCount > count ) workerCount = count;
+  if ( workerCount < 1 )     workerCount = 1;
+  if ( (workers = calloc(workerCount, sizeof(WORKER))) == NULL )
+    {
+      perror("*** Cannot allocate batch workers");
+      exit(EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  if ( verbose & 1 )
+    fprintf(diag, "Running %d jobs from %s on %d threads\n", count, batchPath, workerCount);
+
+  // deal out the jobs in turn, so each worker starts with a share
+  for ( INT32 w = 0 ; w < workerCount ; w++ )
+    {
+      workers[w].queue = malloc((count / workerCount + 1) * sizeof(JOB *));
+      if ( workers[w].queue == NULL )
+	{
+	  perror("*** Cannot allocate batch workers");
+	  exit(EXIT_FAILURE);
+	  /* NOT REACHED */
+	}
+      pthread_mutex_init(&workers[w].lock, NULL);
+    }
+  for ( INT32 i = 0 ; i < count ; i++ )
+    {
+      WORKER *w = &workers[i % workerCount];
+      w->queue[w->tail++] = &jobs[i];
+    }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = catchPause; // pauses every job, each in pace()
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+
+  for ( INT32 w = 0 ; w < workerCount ; w++ )
+    if ( pthread_create(&workers[w].thread, NULL, batchWorker, &workers[w]) != 0 )
+      {
+	perror("*** Cannot start batch worker");
+	exit(EXIT_FAILURE);
+	/* NOT REACHED */
+      }
+  for ( INT32 w = 0 ; w < workerCount ; w++ )
+    {
+      pthread_join(workers[w].thread, NULL);
+      unstarted += workers[w].tail - workers[w].head;
+    }
+  if ( stopping )
+    fprintf(diag, "*** Batch terminated by interrupt, %d jobs not started\n", unstarted);
+
+  // summary, one line per job
+  printf("%5s %5s %14s %16s  %s\n", "line", "exit", "instructions", "simulated secs", "output");
+  for ( INT32 i = 0 ; i < count ; i++ )
+    {
+      printf("%5d %5d %14lld %16.6f  %s\n", jobs[i].line, jobs[i].exitCode,
+	     jobs[i].iCount, jobs[i].emTime / 1000000.0, jobs[i].output);
+      if ( jobs[i].exitCode == EXIT_FAILURE ) failed++;
+      iTotal += jobs[i].iCount;
+    }
+  printf("%d jobs, %d failed, %lld instructions executed in %.3f secs\n",
+	 count, failed, iTotal, (wallClock() - started) / 1e9);
+
+  return ( failed > 0 ) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Read the jobs file into *jobs, returning the number of jobs.  Each line
+// gives the reader, teletype input, store and output paths of one job,
+// separated by spaces.  Blank lines and lines starting with # are ignored.
+INT32 readJobs (JOB **jobs)
+{
+  FILE *f = fopen(batchPath, "r");
+  char line[4 * FILENAME_MAX];
+  INT32 count = 0, size = 0, lineNo = 0;
+
+  if   ( f == NULL )
+    {
+      fprintf(stderr, "*** Cannot open jobs file ");
+      perror(batchPath);
+      exit(EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  *jobs = NULL;
+  while ( fgets(line, sizeof(line), f) != NULL )
+    {
+      char *field[5], *save;
+      INT32 fields = 0;
+      JOB *job;
+
+      lineNo++;
+      for ( char *p = strtok_r(line, " \t\r\n", &save) ; p != NULL && fields < 5 ;
+	    p = strtok_r(NULL, " \t\r\n", &save) )
+	field[fields++] = p;
+      if ( fields == 0 || field[0][0] == '#' ) continue;
+      if ( fields != 4 )
+	{
+	  fprintf(stderr, "*** %s line %d: expected reader, ttyin, store and output paths\n",
+		  batchPath, lineNo);
+	  exit(EXIT_FAILURE);
+	  /* NOT REACHED */
+	}
+      if ( count == size )
+	{
+	  size  = ( size == 0 ) ? 64 : size * 2;
+	  *jobs = realloc(*jobs, size * sizeof(JOB));
+	  if ( *jobs == NULL )
+	    {
+	      perror("*** Cannot allocate jobs");
+	      exit(EXIT_FAILURE);
+	      /* NOT REACHED */
+	    }
+	}
+      job = &(*jobs)[count++];
+      memset(job, 0, sizeof(JOB));
+      job->reader = strdup(field[0]);
+      job->ttyin  = strdup(field[1]);
+      job->store  = strdup(field[2]);
+      job->output = strdup(field[3]);
+      job->line   = lineNo;
+      job->exitCode = EXIT_FAILURE; // until run
+    }
+  fclose(f);
+  return count;
+}
+
+void *batchWorker (void *arg)
+{
+  JOB *job;
+  while ( ! stopping && (job = nextJob((WORKER *) arg)) != NULL ) runJob(job);
+  return NULL;
+}
+
+// Take the next job from the head of w's own queue or, once that is empty,
+// steal one from the tail of another worker's.  Returns NULL when no jobs
+// are left to start.
+JOB *nextJob (WORKER *w)
+{
+  JOB *job = NULL;
+  const INT32 self = w - workers;
+
+  for ( INT32 i = 0 ; job == NULL && i < workerCount ; i++ )
+    {
+      WORKER *v = &workers[(self + i) % workerCount];
+      pthread_mutex_lock(&v->lock);
+      if ( v->head < v->tail )
+	job = ( v == w ) ? v->queue[v->head++] : v->queue[--v->tail];
+      pthread_mutex_unlock(&v->lock);
+    }
+  return job;
+}
+
+// Run job on a new machine with the batch settings.  The job's punch,
+// plotter, teletype output, stop and residual tape files are written to its
+// output directory, which is created if need be.  Its diagnostics are
+// gathered in a buffer and written out whole at the end, so that the
+// reports of jobs running at once do not interleave.
+void runJob (JOB *job)
+{
+  ELLIOTT900 *mc;
+  INT32 reason;
+  char  *report     = NULL;
+  size_t reportSize = 0;
+
+  if ( (diag = open_memstream(&report, &reportSize)) == NULL )
+    diag = batchDiag; // unbuffered then, but still reported
+  mc = newMachine();
+
+  mc->abandon            = batchSettings->abandon;
+  mc->opKeys             = batchSettings->opKeys;
+  mc->plotterPaperWidth  = batchSettings->plotterPaperWidth;
+  mc->plotterPaperHeight = batchSettings->plotterPaperHeight;
+  mc->plotterPenSize     = batchSettings->plotterPenSize;
+  mc->ptrPath            = job->reader;
+  mc->ttyInPath          = job->ttyin;
+  mc->storePath          = job->store;
+  mc->punPath            = joinPath(job->output, PUN_FILE);
+  mc->plotPath           = joinPath(job->output, PLOT_FILE);
+  mc->stopPath           = joinPath(job->output, STOP_FILE);
+  mc->residuePath        = joinPath(job->output, RDR_FILE);
+  if ( batchSettings->callPath != NULL )
+    mc->callPath         = joinPath(job->output, batchSettings->callPath);
+  if ( batchSettings->tracePath != NULL )
+    mc->tracePath        = joinPath(job->output, batchSettings->tracePath);
+  if ( batchSettings->coverPath != NULL )
+    mc->coverPath        = joinPath(job->output, batchSettings->coverPath);
+  if ( batchSettings->snapPath != NULL )
+    mc->snapPath         = joinPath(job->output, batchSettings->snapPath);
+  if ( batchSettings->resumePath != NULL )
+    mc->resumePath       = joinPath(job->output, batchSettings->resumePath);
+  if ( batchSettings->recordPath != NULL )
+    mc->recordPath       = joinPath(job->output, batchSettings->recordPath);
+  if ( batchSettings->replayPath != NULL )
+    mc->replayPath       = joinPath(job->output, batchSettings->replayPath);
+
+  {
+    char *ttyoPath = joinPath(job->output, TTYOUT_FILE);
+    if   ( (mkdir(job->output, 0777) != 0 && errno != EEXIST) ||
+	   (mc->ttyoFile = fopen(ttyoPath, "w")) == NULL )
+      {
+	fprintf(stderr, "*** Cannot set up job output ");
+	perror(ttyoPath);
+	mc->ttyoFile = stdout;
+	job->exitCode = EXIT_FAILURE;
+      }
+    else
+      {
+	mc->batched = TRUE;
+	if ( (reason = sigsetjmp(mc->finish, 1)) == 0 )
+	  emulate(mc); // ends with tidyExit(), so returns through finish
+	job->exitCode = reason - 1;
+      }
+    free(ttyoPath);
+  }
+
+  job->iCount = mc->iCount;
+  job->emTime = mc->emTime;
+  running = NULL;
+  free(mc->punPath);
+  free(mc->plotPath);
+  free(mc->stopPath);
+  free(mc->residuePath);
+  free(mc->callPath);
+  free(mc->tracePath);
+  free(mc->coverPath);
+  free(mc->snapPath);
+  free(mc->resumePath);
+  free(mc->recordPath);
+  free(mc->replayPath);
+  freeMachine(mc);
+
+  if ( diag != batchDiag )
+    {
+      fclose(diag);
+      pthread_mutex_lock(&batchDiagLock);
+      fwrite(report, 1, reportSize, batchDiag);
+      fflush(batchDiag);
+      pthread_mutex_unlock(&batchDiagLock);
+      free(report);
+    }
+  diag = batchDiag;
+}
+
+char *joinPath (const char *dir, const char *name)
+{
+  char *path = malloc(strlen(dir) + strlen(name) + 2);
+  if   ( path == NULL )
+    {
+      perror("*** Cannot allocate path");
+      exit(EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  sprintf(path, "%s/%s", dir, name);
+  return path;
+}
+
+
+/**********************************************************/
+/*              STORE DUMP AND RECOVERY                   */
+/**********************************************************/
+
+ 
+void clearStore(ELLIOTT900 *mc) {
+  for ( INT32 i = 0 ; i < STORE_SIZE ; i++ ) mc->store[i] = 0;
+  memset(mc->decoded, 0, STORE_SIZE * sizeof(DECODED)); // nothing predecoded yet
+  if  ( verbose & 1 )
     fprintf(diag, "Store (%d words) cleared\n", STORE_SIZE);
 }
 
-void readStore () {
-  FILE *f  = fopen(storePath, "r");
+void readStore (ELLIOTT900 *mc) {
+  FILE *f  = fopen(mc->storePath, "r");
   if   ( f != NULL )
     {
       // read store image from file
@@ -902,50 +2899,495 @@ void readStore () {
 	{
 	  if  ( i >= STORE_SIZE )
 	    {
-	      fprintf(stderr, "*** %s exceeds store capacity (%d)\n", storePath, STORE_SIZE);
-	      exit(EXIT_FAILURE);
+	      fprintf(stderr, "*** %s exceeds store capacity (%d)\n", mc->storePath, STORE_SIZE);
+	      stopMachine(mc, EXIT_FAILURE);
 	      /* NOT REACHED */
 	    }
-	  else store[i++] = n;
+	  else mc->store[i++] = n;
 	} // while
       if ( c == 0 )
  	{
-	  fprintf(stderr, "*** Format error in file %s\n", storePath);
-	  exit(EXIT_FAILURE);
+	  fprintf(stderr, "*** Format error in file %s\n", mc->storePath);
+	  stopMachine(mc, EXIT_FAILURE);
 	  /* NOT REACHED */
         }
       else if ( ferror(f) )
 	{
-	  fprintf(stderr, "*** Error while reading %s", storePath);
-	  perror(" - ");
-	  exit(EXIT_FAILURE);
-	  /* NOT REACHED */
-        }
-      fclose(f); // N.B. store file gets re-opened for writing at end of execution
-      if   ( verbose & 1 )
-	fprintf(diag, "%d words read in from %s\n", i, storePath);
+	  fprintf(stderr, "*** Error while reading %s", mc->storePath);
+	  perror(" - ");
+	  stopMachine(mc, EXIT_FAILURE);
+	  /* NOT REACHED */
+        }
+      fclose(f); // N.B. store file gets re-opened for writing at end of execution
+      if   ( verbose & 1 )
+	fprintf(diag, "%d words read in from %s\n", i, mc->storePath);
+    }
+  else if  ( verbose & 1 ) 
+    fprintf (diag, "No %s file found, store left empty\n", mc->storePath);
+
+  mc->storeValid = TRUE;
+}
+
+void writeStore (ELLIOTT900 *mc) {
+   FILE *f = fopen(mc->storePath, "w");
+   if  ( f == NULL ) {
+     fprintf(stderr, ERR_FOPEN_STORE_FILE);
+     perror(mc->storePath);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */ }
+   for ( INT32 i = 0 ; i < STORE_SIZE ; ++i )
+     {
+       fprintf(f, "%7d", mc->store[i]);
+       if  ( ((i%10) == 0) && (i!=0) ) fputc('\n', f);
+     }
+   if  ( verbose & 1 )
+	 fprintf(diag, "%d words written out to %s\n", STORE_SIZE, mc->storePath);
+   fclose(f);
+}
+
+
+/**********************************************************/
+/*                   MACHINE SNAPSHOTS                    */
+/**********************************************************/
+
+
+// Capture the state of mc between instructions.  Takes a copy of the store,
+// so costs a few microseconds.
+void takeSnapshot (ELLIOTT900 *mc, SNAPSHOT *snap)
+{
+  memset(snap, 0, offsetof(SNAPSHOT, store)); // padding too, for writeSnapshot()
+  snap->iCount         = mc->iCount;
+  snap->emTime         = mc->emTime;
+  snap->storeWrites    = mc->storeWrites;
+  snap->ioCount        = mc->ioCount;
+  memcpy(snap->fCount, mc->fCount, sizeof(snap->fCount));
+  snap->aReg           = mc->aReg;
+  snap->qReg           = mc->qReg;
+  snap->bReg           = mc->bReg;
+  snap->scReg          = mc->scReg;
+  snap->lastSCR        = mc->lastSCR;
+  snap->level          = mc->level;
+  snap->instruction    = mc->instruction;
+  snap->f              = mc->f;
+  snap->a              = mc->a;
+  snap->lastttych      = mc->lastttych;
+  snap->punchCount     = mc->punchCount;
+  snap->ttyCount       = mc->ttyCount;
+  snap->plotterPenX    = mc->plotterPenX;
+  snap->plotterPenY    = mc->plotterPenY;
+  snap->plotterPenDown = mc->plotterPenDown;
+  snap->ptrPos         = ( mc->ptrFile  != NULL ) ? ftell(mc->ptrFile)  : 0;
+  snap->ttyiPos        = ( mc->ttyiFile != NULL ) ? ftell(mc->ttyiFile) : 0;
+  snap->punPos         = ( mc->punFile  != NULL ) ? ftell(mc->punFile)  : 0;
+  snap->replayPos      = mc->replayPos;
+  snap->replayCount    = mc->replayCount;
+  snap->ioWait         = mc->ioWait;
+  memcpy(snap->events, mc->events, sizeof(snap->events));
+  snap->eventCount     = mc->eventCount;
+  snap->busy           = mc->busy;
+  snap->active         = mc->active;
+  snap->requests       = mc->requests;
+  snap->interrupts     = mc->interrupts;
+  memcpy(snap->store, mc->store, sizeof(snap->store));
+}
+
+// Return mc to the state captured in snap.  Only store words which differ
+// are written back, so predecoded instructions and translated blocks survive
+// where the code is unchanged.  The reader, teletype input and punch are
+// repositioned, leaving any later punch output to be overwritten.
+void restoreSnapshot (ELLIOTT900 *mc, const SNAPSHOT *snap)
+{
+  for ( INT32 i = 0 ; i < STORE_SIZE ; i++ )
+    if   ( mc->store[i] != snap->store[i] )
+      {
+	mc->store[i] = snap->store[i];
+	INVALIDATE(i);
+      }
+  mc->iCount         = snap->iCount;
+  mc->emTime         = snap->emTime;
+  mc->storeWrites    = snap->storeWrites;
+  mc->ioCount        = snap->ioCount;
+  memcpy(mc->fCount, snap->fCount, sizeof(mc->fCount));
+  mc->aReg           = snap->aReg;
+  mc->qReg           = snap->qReg;
+  mc->bReg           = snap->bReg;
+  mc->scReg          = snap->scReg;
+  mc->lastSCR        = snap->lastSCR;
+  mc->level          = snap->level;
+  mc->instruction    = snap->instruction;
+  mc->f              = snap->f;
+  mc->a              = snap->a;
+  mc->lastttych      = snap->lastttych;
+  mc->punchCount     = snap->punchCount;
+  mc->ttyCount       = snap->ttyCount;
+  mc->plotterPenX    = snap->plotterPenX;
+  mc->plotterPenY    = snap->plotterPenY;
+  mc->plotterPenDown = snap->plotterPenDown;
+  mc->ptrFile  = seekFile(mc, mc->ptrFile,  mc->ptrPath,   "rb",  snap->ptrPos);
+  mc->ttyiFile = seekFile(mc, mc->ttyiFile, mc->ttyInPath, "rb",  snap->ttyiPos);
+  mc->punFile  = seekFile(mc, mc->punFile,  mc->punPath,   "r+b", snap->punPos);
+  mc->replayPos      = snap->replayPos;
+  mc->replayCount    = snap->replayCount;
+  mc->ioWait         = snap->ioWait;
+  memcpy(mc->events, snap->events, sizeof(mc->events));
+  mc->eventCount     = snap->eventCount;
+  mc->busy           = snap->busy;
+  mc->active         = snap->active;
+  mc->requests       = snap->requests;
+  mc->interrupts     = snap->interrupts;
+
+  // the machine has not been running in between
+  if   ( monLoc >= 0 ) mc->monLast = mc->store[monLoc];
+  if   ( mc->watchLast != NULL ) memcpy(mc->watchLast, mc->store, STORE_SIZE * sizeof(INT32));
+  mc->loopHaveSaved = FALSE;
+  mc->loopInterval  = 1;
+  mc->loopSamples   = 0;
+}
+
+// Move file f to pos, first opening path with mode if the file had been
+// opened when the snapshot was taken but not since.  Returns the file.
+FILE *seekFile (ELLIOTT900 *mc, FILE *f, const char *path, const char *mode, INT64 pos)
+{
+  if   ( f == NULL && pos > 0 && (f = fopen(path, mode)) == NULL )
+    {
+      flushTTY(mc);
+      fprintf(stderr, "*** Cannot reopen ");
+      perror(path);
+      tidyExit(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  if   ( f != NULL ) fseek(f, pos, SEEK_SET);
+  return f;
+}
+
+// Write snap to path as SNAP_MAGIC, the state other than the store, the
+// number of words of store up to the last non-zero one and those words,
+// all in the byte order of the host.
+void writeSnapshot (ELLIOTT900 *mc, const SNAPSHOT *snap, const char *path)
+{
+  FILE *f = fopen(path, "wb");
+  INT32 words = STORE_SIZE;
+
+  if   ( f == NULL )
+    {
+      fprintf(stderr, ERR_FOPEN_SNAP_FILE);
+      perror(path);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  while ( words > 0 && snap->store[words-1] == 0 ) words--;
+  fwrite(SNAP_MAGIC, 1, strlen(SNAP_MAGIC), f);
+  fwrite(snap, offsetof(SNAPSHOT, store), 1, f);
+  fwrite(&words, sizeof(words), 1, f);
+  fwrite(snap->store, sizeof(INT32), words, f);
+  if   ( fclose(f) != 0 )
+    {
+      fprintf(stderr, "*** Error while writing %s", path);
+      perror(" - ");
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  if   ( verbose & 1 )
+    fprintf(diag, "Machine state with %d words of store written out to %s\n", words, path);
+}
+
+// Read snap from path, as written by writeSnapshot()
+void readSnapshot (ELLIOTT900 *mc, SNAPSHOT *snap, const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  char magic[sizeof(SNAP_MAGIC)] = "";
+  INT32 words = -1;
+
+  if   ( f == NULL )
+    {
+      fprintf(stderr, "*** Cannot open snapshot file ");
+      perror(path);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  memset(snap, 0, sizeof(SNAPSHOT));
+  if   ( fread(magic, 1, strlen(SNAP_MAGIC), f) != strlen(SNAP_MAGIC)
+	 || strcmp(magic, SNAP_MAGIC) != 0
+	 || fread(snap, offsetof(SNAPSHOT, store), 1, f) != 1
+	 || fread(&words, sizeof(words), 1, f) != 1
+	 || words < 0 || words > STORE_SIZE
+	 || fread(snap->store, sizeof(INT32), words, f) != words )
+    {
+      fprintf(stderr, "*** %s is not a snapshot file\n", path);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  fclose(f);
+  if   ( verbose & 1 )
+    fprintf(diag, "Machine state with %d words of store read in from %s\n", words, path);
+}
+
+
+/**********************************************************/
+/*                 INPUT RECORD AND REPLAY                */
+/**********************************************************/
+
+
+// An input record starts with LOG_MAGIC followed by an entry for each
+// character read from the paper tape reader or teletype, and for running
+// off the end of either.  An entry is a variable length number, seven bits
+// to a byte with the top bit set in all but the last byte, giving
+//
+//    (instructions since the last entry << 2) | INPUT_TAPE or INPUT_TTY
+//                                             | INPUT_END if run off
+//
+// followed by the character unless run off the end.
+
+void startRecord (ELLIOTT900 *mc)
+{
+  if   ( (mc->recordFile = fopen(mc->recordPath, "wb")) == NULL )
+    {
+      fprintf(stderr, "*** Cannot open input record ");
+      perror(mc->recordPath);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  fwrite(LOG_MAGIC, 1, strlen(LOG_MAGIC), mc->recordFile);
+}
+
+// Read the whole input record to be replayed into memory
+void readRecord (ELLIOTT900 *mc)
+{
+  FILE *f = fopen(mc->replayPath, "rb");
+  char magic[sizeof(LOG_MAGIC)] = "";
+
+  if   ( f == NULL )
+    {
+      fprintf(stderr, "*** Cannot open input record ");
+      perror(mc->replayPath);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  fseek(f, 0, SEEK_END);
+  mc->replaySize = ftell(f) - strlen(LOG_MAGIC);
+  rewind(f);
+  if   ( mc->replaySize < 0
+	 || fread(magic, 1, strlen(LOG_MAGIC), f) != strlen(LOG_MAGIC)
+	 || strcmp(magic, LOG_MAGIC) != 0
+	 || (mc->replayLog = malloc(mc->replaySize + 1)) == NULL
+	 || fread(mc->replayLog, 1, mc->replaySize, f) != mc->replaySize )
+    {
+      fprintf(stderr, "*** Cannot read input record %s\n", mc->replayPath);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  fclose(f);
+  if   ( verbose & 1 )
+    fprintf(diag, "%lld bytes of input record read in from %s\n",
+	    mc->replaySize, mc->replayPath);
+}
+
+// Record ch, or EOF, read from device by the instruction counted inputAt.
+// Input executed again by -debug was recorded the first time.
+void recordInput (ELLIOTT900 *mc, INT32 device, INT32 ch)
+{
+  INT64 entry;
+
+  if   ( mc->inputAt <= mc->outputTo ) return;
+  entry = ((mc->inputAt - mc->recordCount) << 2) | device | ( ch == EOF ? INPUT_END : 0 );
+  mc->recordCount = mc->inputAt;
+  while ( entry >= 128 )
+    {
+      fputc((entry & 127) | 128, mc->recordFile);
+      entry >>= 7;
+    }
+  fputc(entry, mc->recordFile);
+  if   ( ch != EOF ) fputc(ch, mc->recordFile);
+}
+
+// Take the next character, or EOF, from the input record, checking that it
+// was read from device by this same instruction.  Any difference means the
+// run has gone a different way from the one recorded.
+INT32 replayInput (ELLIOTT900 *mc, INT32 device)
+{
+  INT64 entry = 0;
+  INT32 shift = 0, byte;
+
+  do
+    {
+      byte   = ( mc->replayPos < mc->replaySize ) ? mc->replayLog[mc->replayPos++] : -1;
+      entry |= (INT64) (byte & 127) << shift;
+      shift += 7;
+    }
+  while ( byte >= 128 );
+  if   ( byte < 0 || (entry & INPUT_TTY) != device
+	 || mc->replayCount + (entry >> 2) != mc->inputAt
+	 || ( ! (entry & INPUT_END) && mc->replayPos >= mc->replaySize ) )
+    {
+      flushTTY(mc);
+      fprintf(stderr, "*** Replay diverged from input record at instruction %lld\n",
+	      mc->inputAt);
+      tidyExit(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  mc->replayCount = mc->inputAt;
+  return ( entry & INPUT_END ) ? EOF : mc->replayLog[mc->replayPos++];
+}
+
+
+/**********************************************************/
+/*                   REVERSE EXECUTION                    */
+/**********************************************************/
+
+
+// Run until a stop, taking a checkpoint every checkInterval instructions
+// into the ring of checkpoints.  The run loop is stopped at each checkpoint
+// by making it the instruction limit, so costs nothing in between.
+INT32 runCheckpointed (ELLIOTT900 *mc)
+{
+  INT32 abandon = mc->abandon; // instruction limit asked for
+  INT32 exitCode;
+
+  do
+    {
+      const INT64 next  = mc->iCount + checkInterval;
+      const INT32 limit = ( next > INT32_MAX || (abandon != -1 && abandon < next) )
+	                  ? abandon : next;
+      takeSnapshot(mc, &mc->checkpoints[mc->checkNext]);
+      mc->checkNext = (mc->checkNext + 1) % CHECKPOINTS;
+      if ( mc->checkCount < CHECKPOINTS ) mc->checkCount++;
+      mc->abandon = limit;
+      exitCode = runLoop(mc);
+      if ( mc->abandon != limit ) abandon = mc->abandon; // moved by -rtrace
+    }
+  while ( exitCode == EXIT_LIMITSTOP && mc->iCount != abandon );
+  mc->abandon = abandon;
+  return exitCode;
+}
+
+// Debug the stopped machine, taking commands from stdin.  Any instruction
+// since the oldest checkpoint can be reached by restoring the nearest
+// checkpoint before it and stepping forward, teletype output sent already
+// being suppressed.  The machine is left as it stopped.
+void debugMachine (ELLIOTT900 *mc)
+{
+  SNAPSHOT *stopped = malloc(sizeof(SNAPSHOT)); // state at the stop
+  char line[80];
+
+  if   ( stopped == NULL ) return;
+  mc->debugging = TRUE;
+  mc->abandon   = -1;
+  mc->paceTime  = NEVER;
+  takeSnapshot(mc, stopped);
+  mc->outputTo  = stopped->iCount;
+  flushTTY(mc);
+  fflush(stdout);
+  fprintf(stderr, "Stopped after %lld instructions, %lld back to the oldest checkpoint\n",
+	  mc->iCount, mc->iCount - mc->checkpoints[( mc->checkCount < CHECKPOINTS ) ? 0 : mc->checkNext].iCount);
+  printDiagnostics(mc);
+
+  while ( fprintf(stderr, "debug> "), fgets(line, sizeof(line), stdin) != NULL )
+    {
+      char cmd[8] = "", arg[32] = "";
+      const INT64 now = mc->iCount;
+      INT64 n, to = -1;
+      INT32 addr;
+
+      sscanf(line, "%7s %31s", cmd, arg);
+      n    = ( arg[0] != '\0' ) ? atoll(arg) : 1;
+      addr = ( arg[0] != '\0' ) ? addtoi(arg) : -1;
+      if      ( strcmp(cmd, "q") == 0 )
+	break;
+      else if ( strcmp(cmd, "p") == 0 )
+	to = now;
+      else if ( strcmp(cmd, "c") == 0 )
+	to = stopped->iCount;
+      else if ( strcmp(cmd, "rs") == 0 && n >= 0 )
+	to = now - n;
+      else if ( strcmp(cmd, "s") == 0 && n >= 0 )
+	{
+	  // step forward tracing each instruction, but not beyond the stop
+	  while ( n-- > 0 && mc->iCount < stopped->iCount )
+	    {
+	      goTo(mc, stopped, mc->iCount + 1);
+	      printDiagnostics(mc);
+	    }
+	  continue;
+	}
+      else if ( (strcmp(cmd, "rc") == 0 || strcmp(cmd, "rw") == 0)
+		&& addr >= 0 && addr < STORE_SIZE )
+	{
+	  if ( (to = findLast(mc, addr, cmd[1] == 'w')) < 0 )
+	    {
+	      fprintf(stderr, "Not found since the oldest checkpoint\n");
+	      to = now;
+	    }
+	}
+      else
+	{
+	  fprintf(stderr, "s [n]   step forward n instructions\n"
+		  "rs [n]  step back n instructions\n"
+		  "rc a    back to last execution of instruction at address a\n"
+		  "rw a    back to last change to the word at address a\n"
+		  "c       forward to the stop\n"
+		  "p       print state\n"
+		  "q       quit, leaving the machine as it stopped\n");
+	  continue;
+	}
+      if   ( ! goTo(mc, stopped, to) )
+	{
+	  fprintf(stderr, "Instruction %lld is before the oldest checkpoint\n", to);
+	  goTo(mc, stopped, now);
+	}
+      printDiagnostics(mc);
     }
-  else if  ( verbose & 1 ) 
-    fprintf (diag, "No %s file found, store left empty\n", storePath);
 
-  storeValid = TRUE;
+  restoreSnapshot(mc, stopped);
+  free(stopped);
 }
 
-void writeStore () {
-   FILE *f = fopen(storePath, "w");
-   if  ( f == NULL ) {
-     fprintf(stderr, ERR_FOPEN_STORE_FILE);
-     perror(storePath);
-      exit(EXIT_FAILURE);
-      /* NOT REACHED */ }
-   for ( INT32 i = 0 ; i < STORE_SIZE ; ++i )
-     {
-       fprintf(f, "%7d", store[i]);
-       if  ( ((i%10) == 0) && (i!=0) ) fputc('\n', f);
-     }
-   if  ( verbose & 1 )
-	 fprintf(diag, "%d words written out to %s\n", STORE_SIZE, storePath);
-   fclose(f);
+// Move mc to the state after the instruction counted to was executed,
+// stepping from the current state if that lies between the nearest
+// checkpoint and to.  Returns FALSE, leaving mc unchanged, if to is before
+// the oldest checkpoint.
+INT32 goTo (ELLIOTT900 *mc, const SNAPSHOT *stopped, INT64 to)
+{
+  const SNAPSHOT *from = NULL; // latest checkpoint at or before to
+
+  if   ( to >= stopped->iCount ) // possibly stopped part way through
+    {
+      restoreSnapshot(mc, stopped);
+      return TRUE;
+    }
+  for ( INT32 i = 0 ; i < mc->checkCount ; i++ )
+    if ( mc->checkpoints[i].iCount <= to
+	 && (from == NULL || mc->checkpoints[i].iCount > from->iCount) )
+      from = &mc->checkpoints[i];
+  if   ( from == NULL ) return FALSE;
+  if   ( mc->iCount > to || mc->iCount < from->iCount ) restoreSnapshot(mc, from);
+  while ( mc->iCount < to ) stepSwitch(mc);
+  return TRUE;
+}
+
+// Find the last instruction before the current one which was at addr or,
+// if watch, which changed the word at addr.  Works back from the latest
+// checkpoint, re-executing each interval.  Returns its instruction count,
+// or -1 if there is none since the oldest checkpoint.
+INT64 findLast (ELLIOTT900 *mc, INT32 addr, INT32 watch)
+{
+  INT64 end = mc->iCount - 1; // last instruction still to be searched
+
+  for ( INT32 k = 1 ; k <= mc->checkCount ; k++ )
+    {
+      const SNAPSHOT *cp = &mc->checkpoints[(mc->checkNext - k + CHECKPOINTS) % CHECKPOINTS];
+      INT64 found = -1;
+      if ( cp->iCount >= end ) continue;
+      restoreSnapshot(mc, cp);
+      while ( mc->iCount < end )
+	{
+	  const INT32 old = mc->store[addr];
+	  stepSwitch(mc);
+	  if ( watch ? mc->store[addr] != old : mc->lastSCR == addr ) found = mc->iCount;
+	}
+      if ( found >= 0 ) return found;
+      end = cp->iCount;
+    }
+  return -1;
 }
 
 
@@ -954,28 +3396,558 @@ void writeStore () {
 /**********************************************************/
 
 
- void printDiagnostics(INT32 instruction, INT32 f, INT32 a) {
+void printDiagnostics (ELLIOTT900 *mc)
+{
+  const TRACE t = { mc->iCount, mc->lastSCR, mc->instruction, mc->aReg, mc->qReg,
+		    mc->store[mc->bReg], mc->level };
+  printTrace(diag, &t);
+}
+
+// Print instruction t of a trace in the form used by printDiagnostics()
+ void printTrace(FILE *out, const TRACE *t) {
+   const INT32 f = (t->instruction >> FN_SHIFT) & FN_MASK;
+   const INT32 a = (t->instruction & ADDR_MASK) | (t->scr & MOD_MASK);
    // extend sign bit for A, Q and B register values
-   INT32 an = ( aReg >= BIT18 ? aReg - BIT19 : aReg); 
-   INT32 qn = ( qReg >= BIT18 ? qReg - BIT19 : qReg);
-   INT32 bn = ( store[bReg] >= BIT18 ? store[bReg] - BIT19 : store[bReg]);
-   fprintf(diag, "%10lld   ", iCount); // instruction count
-   printAddr(diag, lastSCR);    // SCR and registers
-   if   (instruction & BIT18 )
+   INT32 an = ( t->aReg >= BIT18 ? t->aReg - BIT19 : t->aReg); 
+   INT32 qn = ( t->qReg >= BIT18 ? t->qReg - BIT19 : t->qReg);
+   INT32 bn = ( t->bValue >= BIT18 ? t->bValue - BIT19 : t->bValue);
+   fprintf(out, "%10lld   ", t->iCount); // instruction count
+   printAddr(out, t->scr); // SCR and registers
+   if   (t->instruction & BIT18 )
      {
        if   ( f > 9 )
-	 fprintf(diag, " /");
+	 fprintf(out, " /");
       else
-	fprintf(diag, "  /"); }
+	fprintf(out, "  /"); }
     else if  (f > 9 )
-      fprintf(diag, "  ");
+      fprintf(out, "  ");
     else
+      fprintf(out, "   ");
+    fprintf(out, "%d %4d", f, a);
+    fprintf(out, " A=%+8d (&%06o) Q=%+8d (&%06o) B=%+7d (",
+		 an, t->aReg, qn, t->qReg, bn);
+    printAddr(out, t->bValue);
+    fprintf(out, ")\n");
+}
+
+// Trace the current instruction, adding it to the binary trace if there is
+// one, otherwise printing it
+void traceInstruction (ELLIOTT900 *mc)
+{
+  TRACERING  *r = mc->trace;
+  INT64       head;
+  TRACE      *t;
+
+  if   ( r == NULL )
+    {
+      flushTTY(mc);
+      printDiagnostics(mc);
+      return;
+    }
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  while ( head - atomic_load_explicit(&r->tail, memory_order_acquire) >= TRACE_RING )
+    nanosleep(&(struct timespec) { 0, TRACE_POLL / 10 }, NULL); // full, wait for writer
+  t = &r->records[head & (TRACE_RING - 1)];
+  t->iCount      = mc->iCount;
+  t->scr         = mc->lastSCR;
+  t->instruction = mc->instruction;
+  t->aReg        = mc->aReg;
+  t->qReg        = mc->qReg;
+  t->bValue      = mc->store[mc->bReg];
+  t->level       = mc->level;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+// Report a store into watched location addr by the current instruction, then
+// trace the instruction or stop after it as asked.  A stop is made as
+// -abandon makes one.  Stores executed again by -debug were reported the
+// first time.
+void watchHit (ELLIOTT900 *mc, INT32 addr)
+{
+  const INT32 old = mc->watchLast[addr];
+
+  mc->watchLast[addr] = mc->store[addr];
+  if   ( mc->iCount <= mc->outputTo ) return;
+  flushTTY(mc);
+  fprintf(diag, "Store into watched location ");
+  printAddr(diag, addr);
+  fprintf(diag, " (%d to %d) by instruction %lld at ",
+	  old, mc->store[addr], mc->iCount);
+  printAddr(diag, mc->lastSCR);
+  fputc('\n', diag);
+  if      ( watchAction[addr] == WATCH_TRACE )
+    traceInstruction(mc);
+  else if ( watchAction[addr] == WATCH_STOP )
+    mc->abandon = mc->iCount;
+}
+
+// TRUE if the run is to stop at a breakpoint at addr, whose instruction is
+// about to be executed: one of those there has its condition met and has
+// now been hit the number of times asked.  SCR and everything else are left
+// as they are before the instruction, so that the run can be carried on.
+// It is not stopped again at the same point, nor by instructions executed
+// again by -debug.
+INT32 breakHit (ELLIOTT900 *mc, INT32 addr)
+{
+  INT32 stop = FALSE;
+
+  if   ( mc->iCount == mc->breakAt || mc->iCount < mc->outputTo ) return FALSE;
+  for ( INT32 i = 0 ; i < breakCount ; i++ )
+    {
+      const BREAKPOINT *bp = &breakpoints[i];
+      INT32 r, v;
+      if ( bp->addr != addr ) continue;
+      if ( bp->reg != '\0' )
+	{
+	  r = ( bp->reg == 'A' ) ? mc->aReg : ( bp->reg == 'Q' ) ? mc->qReg : mc->store[mc->bReg];
+	  v = ( r >= BIT18 ) ? r - BIT19 : r; // extend sign bit
+	  if ( ! ( v < bp->value ? strchr(bp->op, '<') || strchr(bp->op, '!') :
+		   v > bp->value ? strchr(bp->op, '>') || strchr(bp->op, '!') :
+		                   strchr(bp->op, '=') && ! strchr(bp->op, '!') ) )
+	    continue;
+	}
+      if ( ++mc->breakHits[i] >= bp->count ) stop = TRUE;
+    }
+  if   ( ! stop ) return FALSE;
+
+  mc->breakAt = mc->iCount;
+  flushTTY(mc);
+  if   ( verbose & 1 )
+    {
+      fprintf(diag, "Breakpoint at ");
+      printAddr(diag, addr);
+      fprintf(diag, " after %lld instructions\n", mc->iCount);
+    }
+  return TRUE;
+}
+
+// Open the binary trace file and start the thread writing it
+void startTrace (ELLIOTT900 *mc)
+{
+  TRACERING *r = calloc(1, sizeof(TRACERING));
+
+  if   ( r == NULL || (r->records = malloc(TRACE_RING * sizeof(TRACE))) == NULL )
+    {
+      perror("*** Cannot allocate binary trace");
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  mc->trace = r;
+  if   ( (r->file = fopen(mc->tracePath, "wb")) == NULL )
+    {
+      fprintf(stderr, "*** Cannot write binary trace to ");
+      perror(mc->tracePath);
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), r->file);
+  if   ( pthread_create(&r->writer, NULL, traceWriter, r) != 0 )
+    {
+      fprintf(stderr, "*** Cannot start binary trace writer\n");
+      fclose(r->file);
+      r->file = NULL;
+      stopMachine(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+}
+
+// Wait for the writer to write out the records left in the ring and close
+// the binary trace
+void endTrace (ELLIOTT900 *mc)
+{
+  TRACERING *r = mc->trace;
+
+  if   ( r->file == NULL ) return;
+  atomic_store(&r->done, TRUE);
+  pthread_join(r->writer, NULL);
+  fclose(r->file);
+  r->file = NULL;
+  if   ( verbose & 1 )
+    fprintf(diag, "%lld instructions traced to %s\n", r->head, mc->tracePath);
+}
+
+// Body of the thread writing out the records of ring, TRACE_BLOCK at a time
+// until the trace ends
+void *traceWriter (void *ring)
+{
+  TRACERING *r = ring;
+  INT64 tail = 0;
+
+  while ( TRUE )
+    {
+      const INT32 done = atomic_load(&r->done); // before head, so none are missed
+      const INT64 head = atomic_load_explicit(&r->head, memory_order_acquire);
+      INT64 n = head - tail;
+
+      if   ( n >= TRACE_BLOCK || (done && n > 0) )
+	{
+	  const INT64 from = tail & (TRACE_RING - 1);
+	  if ( n > TRACE_BLOCK ) n = TRACE_BLOCK;
+	  if ( n > TRACE_RING - from ) n = TRACE_RING - from; // up to the end of the ring
+	  fwrite(&r->records[from], sizeof(TRACE), n, r->file);
+	  tail += n;
+	  atomic_store_explicit(&r->tail, tail, memory_order_release);
+	}
+      else if ( done )
+	return NULL;
+      else
+	nanosleep(&(struct timespec) { 0, TRACE_POLL }, NULL);
+    }
+}
+
+// Print the binary trace at path to stdout as text traces are printed.
+// Returns EXIT_SUCCESS, or EXIT_FAILURE if it is not a binary trace.
+INT32 decodeTrace (const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  char magic[sizeof(TRACE_MAGIC)] = "";
+  TRACE *block = malloc(TRACE_BLOCK * sizeof(TRACE));
+  size_t n;
+
+  if   ( f == NULL || block == NULL
+	 || fread(magic, 1, strlen(TRACE_MAGIC), f) != strlen(TRACE_MAGIC)
+	 || strcmp(magic, TRACE_MAGIC) != 0 )
+    {
+      fprintf(stderr, "*** Cannot read binary trace %s\n", path);
+      return EXIT_FAILURE;
+    }
+  while ( (n = fread(block, sizeof(TRACE), TRACE_BLOCK, f)) > 0 )
+    for ( size_t i = 0 ; i < n ; i++ ) printTrace(stdout, &block[i]);
+  fclose(f);
+  free(block);
+  return EXIT_SUCCESS;
+}
+
+// List the PROFILE_LINES addresses taking most time, with the instruction
+// now at each, their share of the time and, for a profile of every
+// instruction, the number of times each was executed.
+void printProfile (ELLIOTT900 *mc)
+{
+  INT32 *order = malloc(STORE_SIZE * sizeof(INT32));
+  INT32 n = 0;
+  INT64 total = 0;
+
+  if   ( order == NULL ) return;
+  for ( INT32 i = 0 ; i < STORE_SIZE ; i++ )
+    if ( mc->profile[i].count != 0 )
+      {
+	order[n++] = i;
+	total += mc->profile[i].time;
+      }
+  profileSorting = mc->profile;
+  qsort(order, n, sizeof(INT32), compareProfile);
+
+  flushTTY(mc);
+  fprintf(diag, "Profile of %d addresses%s, ", n,
+	  ( profileEvery == 0 ) ? "" : " sampled");
+  printTime(total);
+  fprintf(diag, " of simulated time\n");
+  fprintf(diag, "  address  instruction   %12s  %14s  time\n",
+	  ( profileEvery == 0 ) ? "executions" : "samples", "microseconds");
+  for ( INT32 k = 0 ; k < n && k < PROFILE_LINES ; k++ )
+    {
+      const INT32   addr = order[k];
+      const INT32   ins  = mc->store[addr];
+      const PROFILE *p   = &mc->profile[addr];
       fprintf(diag, "   ");
-    fprintf(diag, "%d %4d", f, a);
-    fprintf(diag, " A=%+8d (&%06o) Q=%+8d (&%06o) B=%+7d (",
-		 an, aReg, qn, qReg, bn);
-    printAddr(diag, store[bReg]);
-    fprintf(diag, ")\n");
+      printAddr(diag, addr);
+      fprintf(diag, "  %c%2d %4d     %12lld  %14lld  %5.1f%%\n",
+	      ( ins & BIT18 ) ? '/' : ' ', (ins >> FN_SHIFT) & FN_MASK, ins & ADDR_MASK,
+	      p->count, p->time, ( total > 0 ) ? p->time * 100.0 / total : 0.0);
+    }
+  free(order);
+}
+
+// qsort() comparison putting addresses of profileSorting in decreasing order
+// of time
+INT32 compareProfile (const void *x, const void *y)
+{
+  const INT64 tx = profileSorting[*(const INT32 *) x].time;
+  const INT64 ty = profileSorting[*(const INT32 *) y].time;
+  return ( tx < ty ) - ( tx > ty );
+}
+
+// Charge the instruction just executed to the calling context it ran in,
+// then follow any call or return it made.  A call is a Store S followed by
+// a jump, the link stored being the address of the jump.  A return is a
+// jump to the instruction after the jump of any call not yet returned from,
+// so that exits missing out levels of return are followed too.
+void traceCalls (ELLIOTT900 *mc)
+{
+  CALLNODE   *node = &mc->callNodes[mc->callStack[mc->callDepth].node];
+  const INT32 to   = mc->store[mc->scReg];
+
+  node->count++;
+  node->time += mc->emTime - mc->callTime;
+  mc->callTime = mc->emTime;
+
+  if   ( mc->f == 8 && mc->lastSCR == mc->callAt )
+    {
+      if   ( mc->callDepth < CALL_DEPTH - 1 )
+	{
+	  const INT32 n = callNode(mc, mc->callStack[mc->callDepth].node, to);
+	  mc->callNodes[n].calls++;
+	  mc->callDepth++;
+	  mc->callStack[mc->callDepth].node = n;
+	  mc->callStack[mc->callDepth].ret  = mc->lastSCR + 1;
+	}
+    }
+  else if ( mc->f >= 7 && mc->f <= 9 )
+    for ( INT32 d = mc->callDepth ; d > 0 ; d-- )
+      if   ( mc->callStack[d].ret == to )
+	{
+	  mc->callDepth = d - 1;
+	  break;
+	}
+  mc->callAt = ( mc->f == 11 ) ? mc->lastSCR + 1 : -1;
+}
+
+// Context of a call to entry from context parent, added if not called that
+// way before.  Returns parent if there is no room for another context.
+INT32 callNode (ELLIOTT900 *mc, INT32 parent, INT32 entry)
+{
+  INT32 n;
+
+  for ( n = mc->callNodes[parent].child ; n >= 0 ; n = mc->callNodes[n].sibling )
+    if ( mc->callNodes[n].entry == entry ) return n;
+
+  if   ( mc->callNodeCount == mc->callNodeSize )
+    {
+      CALLNODE *more = realloc(mc->callNodes, 2 * mc->callNodeSize * sizeof(CALLNODE));
+      if ( more == NULL ) return parent;
+      mc->callNodes = more;
+      mc->callNodeSize *= 2;
+    }
+  n = mc->callNodeCount++;
+  memset(&mc->callNodes[n], 0, sizeof(CALLNODE));
+  mc->callNodes[n].entry   = entry;
+  mc->callNodes[n].parent  = parent;
+  mc->callNodes[n].child   = -1;
+  mc->callNodes[n].sibling = mc->callNodes[parent].child;
+  mc->callNodes[parent].child = n;
+  return n;
+}
+
+// List the PROFILE_LINES subroutines taking most time including the
+// subroutines they call, and write the call graph to callPath in the folded
+// stack form taken by flame graph tools: one line per calling context
+// giving its chain of entry addresses from the root and the emulated
+// microseconds spent in the context itself.  Time in a recursive call is
+// included only once in the inclusive totals of a subroutine.
+void printCalls (ELLIOTT900 *mc)
+{
+  CALLNODE *node = mc->callNodes;
+  CALLNODE *sub  = calloc(STORE_SIZE, sizeof(CALLNODE));
+  INT32    *order = malloc(STORE_SIZE * sizeof(INT32));
+  INT32     subs = 0;
+  FILE     *f;
+
+  // contexts follow their callers, so work back adding totals to callers
+  for ( INT32 n = mc->callNodeCount - 1 ; n >= 0 ; n-- )
+    {
+      node[n].inCount += node[n].count;
+      node[n].inTime  += node[n].time;
+      if   ( n > 0 )
+	{
+	  node[node[n].parent].inCount += node[n].inCount;
+	  node[node[n].parent].inTime  += node[n].inTime;
+	}
+    }
+
+  if   ( (f = fopen(mc->callPath, "w")) == NULL )
+    {
+      fprintf(stderr, "*** Cannot write call graph to ");
+      perror(mc->callPath);
+    }
+  else
+    {
+      for ( INT32 n = 0 ; n < mc->callNodeCount ; n++ )
+	if   ( node[n].time != 0 )
+	  {
+	    writeCallPath(mc, f, n);
+	    fprintf(f, " %lld\n", node[n].time);
+	  }
+      fclose(f);
+    }
+
+  if   ( sub == NULL || order == NULL )
+    {
+      free(sub);
+      free(order);
+      return;
+    }
+  for ( INT32 n = 1 ; n < mc->callNodeCount ; n++ )
+    {
+      const INT32 e = node[n].entry;
+      INT32 p = node[n].parent;
+      if   ( e < 0 || e >= STORE_SIZE ) continue;
+      if   ( sub[e].calls == 0 && sub[e].count == 0 ) order[subs++] = e;
+      sub[e].calls += node[n].calls;
+      sub[e].count += node[n].count;
+      sub[e].time  += node[n].time;
+      while ( p > 0 && node[p].entry != e ) p = node[p].parent;
+      if   ( p <= 0 ) // not within an outer call of the same subroutine
+	{
+	  sub[e].inCount += node[n].inCount;
+	  sub[e].inTime  += node[n].inTime;
+	}
+    }
+  callSorting = sub;
+  qsort(order, subs, sizeof(INT32), compareCalls);
+
+  flushTTY(mc);
+  fprintf(diag, "Call graph of %d subroutines in %d contexts written to %s\n",
+	  subs, mc->callNodeCount - 1, mc->callPath);
+  fprintf(diag, "  entry        calls  instructions    (self)  microseconds    (self)  time\n");
+  for ( INT32 k = 0 ; k < subs && k < PROFILE_LINES ; k++ )
+    {
+      const CALLNODE *c = &sub[order[k]];
+      fprintf(diag, "  ");
+      printAddr(diag, order[k]);
+      fprintf(diag, " %10lld  %12lld %9lld  %12lld %9lld  %5.1f%%\n",
+	      c->calls, c->inCount, c->count, c->inTime, c->time,
+	      ( node[0].inTime > 0 ) ? c->inTime * 100.0 / node[0].inTime : 0.0);
+    }
+  free(sub);
+  free(order);
+}
+
+// Write the entry addresses of the calls leading to context n, separated by
+// semicolons, the root being "top"
+void writeCallPath (ELLIOTT900 *mc, FILE *f, INT32 n)
+{
+  if   ( n == 0 )
+    fprintf(f, "top");
+  else
+    {
+      writeCallPath(mc, f, mc->callNodes[n].parent);
+      fputc(';', f);
+      printAddr(f, mc->callNodes[n].entry);
+    }
+}
+
+// qsort() comparison putting addresses of callSorting in decreasing order
+// of inclusive time
+INT32 compareCalls (const void *x, const void *y)
+{
+  const INT64 tx = callSorting[*(const INT32 *) x].inTime;
+  const INT64 ty = callSorting[*(const INT32 *) y].inTime;
+  return ( tx < ty ) - ( tx > ty );
+}
+
+// Mark the instruction at addr, about to be executed, and the words it
+// addresses, then make its predecoded entry valid so that it is marked
+// again only once decoded again.  An instruction which is B modified or
+// loads B is left invalid, as the words it addresses can change, as is a
+// Store A whose write depends on the priority level.
+void coverInstruction (ELLIOTT900 *mc, INT32 addr)
+{
+  DECODED *d = &mc->decoded[addr];
+
+  COVER(COVER_EXECUTED, addr);
+  coverOperand(mc, d->f, ( d->bMod ) ? (d->a + mc->store[mc->bReg]) & MASK16 : d->a & MASK16);
+  d->valid = ( addr >= REG_LOCS && ! d->brk && ! d->bMod && d->f != 0
+	       && ! COVER_BY_LEVEL(d->f, d->a & MASK16) );
+}
+
+// Mark the micro-ops of blk executed up to op and the words they address,
+// never B modified in a block when covering, remembering when all have been.
+// Called by accountBlock(), for a block the run ends in up to lastSCR, which
+// runBlock() and jitStep() set before any micro-op that can end it: an i/o
+// error, the end of input, an unsupported instruction or a store fault.
+void coverBlock (ELLIOTT900 *mc, BLOCK *blk, const UOP *op)
+{
+  const INT32 start = blk - mc->blocks;
+
+  for ( const UOP *p = blk->ops ; p < op ; p++ )
+    {
+      COVER(COVER_EXECUTED, start + (p - blk->ops));
+      coverOperand(mc, p->f, p->a & MASK16);
+    }
+  blk->covered = ( op == blk->ops + blk->length );
+}
+
+// Mark word m, addressed by an instruction with function code f, as read
+// or written
+void coverOperand (ELLIOTT900 *mc, INT32 f, INT32 m)
+{
+  if ( m >= STORE_SIZE ) return; // faults in the guard pages when executed
+  switch ( f )
+    {
+    case 0: // Load B, which also writes B
+      COVER(COVER_WRITTEN, mc->bReg);
+      COVER(COVER_READ, m);
+      break;
+
+    case 1: case 2: case 4: case 6: case 12: case 13:
+      COVER(COVER_READ, m);
+      break;
+
+    case 10: // increment in store
+      COVER(COVER_READ, m);
+      COVER(COVER_WRITTEN, m);
+      break;
+
+    case 5: // Store A, as emu900ops.h
+      if ( ! (mc->level == 1 && COVER_BY_LEVEL(f, m)) ) COVER(COVER_WRITTEN, m);
+      break;
+
+    case 3: case 11:
+      COVER(COVER_WRITTEN, m);
+      break;
+    }
+}
+
+// Write the coverage bitmaps to coverPath, then list the words executed,
+// read and written as ranges of addresses
+void writeCoverage (ELLIOTT900 *mc)
+{
+  static const char *const kinds[COVER_KINDS] = { "executed", "read", "written" };
+  INT32 words[COVER_KINDS] = { 0 };
+  FILE *f;
+
+  if   ( (f = fopen(mc->coverPath, "wb")) == NULL )
+    {
+      fprintf(stderr, "*** Cannot write coverage to ");
+      perror(mc->coverPath);
+    }
+  else
+    {
+      fwrite(COVER_MAGIC, 1, strlen(COVER_MAGIC), f);
+      fwrite(mc->coverage, 1, COVER_KINDS * COVER_BYTES, f);
+      if ( fclose(f) != 0 )
+	{
+	  fprintf(stderr, "*** Error while writing %s", mc->coverPath);
+	  perror(" - ");
+	}
+    }
+
+  for ( INT32 k = 0 ; k < COVER_KINDS ; k++ )
+    for ( INT32 a = 0 ; a < STORE_SIZE ; a++ )
+      words[k] += COVERED(k, a);
+  flushTTY(mc);
+  fprintf(diag, "Store coverage written to %s: %d words executed, %d read, %d written\n",
+	  mc->coverPath, words[COVER_EXECUTED], words[COVER_READ], words[COVER_WRITTEN]);
+  for ( INT32 k = 0 ; k < COVER_KINDS ; k++ )
+    {
+      INT32 ranges = 0;
+      for ( INT32 a = 0 ; a < STORE_SIZE ; a++ )
+	if   ( COVERED(k, a) )
+	  {
+	    const INT32 from = a;
+	    while ( a + 1 < STORE_SIZE && COVERED(k, a + 1) ) a++;
+	    if ( ranges++ % COVER_RANGES == 0 )
+	      fprintf(diag, "%s  %-8s", ( ranges > 1 ) ? "\n" : "", ( ranges > 1 ) ? "" : kinds[k]);
+	    fputc(' ', diag);
+	    printAddr(diag, from);
+	    if   ( a > from )
+	      {
+		fputc('-', diag);
+		printAddr(diag, a);
+	      }
+	  }
+      if ( ranges > 0 ) fputc('\n', diag);
+    }
 }
 
 void printTime (INT64 us) { // print out time in us
@@ -993,36 +3965,67 @@ void printTime (INT64 us) { // print out time in us
 
 /* Exit and tidy up */
  
-void tidyExit (INT32 reason) {
-  if ( storeValid )
+void tidyExit (ELLIOTT900 *mc, INT32 reason) {
+  if ( mc->inBlock != NULL ) // run ended by a micro-op before the end of a block
+    accountBlock(mc, mc->inBlock,
+		 mc->inBlock->ops + (mc->lastSCR - (mc->inBlock - mc->blocks)) + 1, TRUE);
+  if ( mc->checkpoints != NULL && ! mc->debugging )
+    debugMachine(mc); // look back over the run before tidying up
+  if ( mc->storeValid )
     {
-      flushTTY();
-      writeStore(); // save store for next run
+      flushTTY(mc);
+      writeStore(mc); // save store for next run
+      if   ( mc->snapPath != NULL ) // ... and whole machine state if asked
+	{
+	  SNAPSHOT *snap = malloc(sizeof(SNAPSHOT));
+	  if   ( snap != NULL )
+	    {
+	      takeSnapshot(mc, snap);
+	      if   ( strcmp(mc->residuePath, mc->ptrPath) == 0 )
+		snap->ptrPos = 0; // unread tape is about to be copied over the reader file
+	      writeSnapshot(mc, snap, mc->snapPath);
+	      free(snap);
+	    }
+	}
       if   ( verbose & 1 )
-	fprintf(diag, "Copying over residual input to %s\n", RDR_FILE);
-      if  ( ptrFile  != NULL )
+	fprintf(diag, "Copying over residual input to %s\n", mc->residuePath);
+      if  ( mc->ptrFile  != NULL )
 	{
 	  INT32 ch;
-	  FILE *ptrFile2 = fopen(RDR_FILE, "wb");
+	  FILE *ptrFile2 = fopen(mc->residuePath, "wb");
 	  if  ( ptrFile2 == NULL )
 	    {
-	      fprintf(stderr, "*** Unable to save paper tape to %s", RDR_FILE);
+	      fprintf(stderr, "*** Unable to save paper tape to %s", mc->residuePath);
 	      perror("");
-	      putTTYOchar('\n');
-	      exit(EXIT_FAILURE);
+	      putTTYOchar(mc, '\n');
+	      stopMachine(mc, EXIT_FAILURE);
 	      /* NOT REACHED */
 	    }
-	  while ( (ch = fgetc(ptrFile)) != EOF ) fputc(ch, ptrFile2);
+	  while ( (ch = fgetc(mc->ptrFile)) != EOF ) fputc(ch, ptrFile2);
 	  fclose(ptrFile2);
 	}
     }
-  if ( ptrFile      != NULL ) fclose(ptrFile);
-  if ( ttyiFile     != NULL ) fclose(ttyiFile);
-  if ( punFile      != NULL ) fclose(punFile);
-  if ( plotterPaper != NULL ) savePlotterPaper();
-  if ( diag         != stderr ) fclose(diag);
+  if ( mc->ptrFile      != NULL ) fclose(mc->ptrFile);
+  if ( mc->ttyiFile     != NULL ) fclose(mc->ttyiFile);
+  if ( mc->punFile      != NULL ) fclose(mc->punFile);
+  if ( mc->recordFile   != NULL ) fclose(mc->recordFile);
+  if ( mc->trace        != NULL ) endTrace(mc);
+  if ( mc->ttyoFile     != stdout ) fclose(mc->ttyoFile);
+  if ( mc->plotterPaper != NULL ) savePlotterPaper(mc);
+
+  if ( mc->profile      != NULL ) printProfile(mc);
+  if ( mc->callNodes    != NULL ) printCalls(mc);
+  if ( mc->coverage     != NULL ) writeCoverage(mc);
 
   if ( verbose & 1 ) fprintf(diag, "Exiting %d\n", reason);
+  if ( diag         != stderr && ! mc->batched ) fclose(diag);
+  stopMachine(mc, reason);
+}
+
+// Leave machine mc with exit code reason, ending the process unless mc is
+// running a batch job, which is ended instead by returning to runJob()
+void stopMachine (ELLIOTT900 *mc, INT32 reason) {
+  if ( mc->batched ) siglongjmp(mc->finish, reason + 1); // 0 is taken by sigsetjmp()
   exit(reason);
 }
 
@@ -1032,25 +4035,25 @@ void tidyExit (INT32 reason) {
 /**********************************************************/
 
 
-void setupPlotter (void)
+void setupPlotter (ELLIOTT900 *mc)
 {
-    INT32 paperSize = 3*plotterPaperWidth*plotterPaperHeight; 
+    INT32 paperSize = 3*mc->plotterPaperWidth*mc->plotterPaperHeight; 
     // Using 24bit R,G,B so 3 bytes per pixel.
-    plotterPaper = malloc(paperSize);
+    mc->plotterPaper = malloc(paperSize);
 
-    if  ( plotterPaper != NULL )
+    if  ( mc->plotterPaper != NULL )
     {
 	// Set to all 0xFF for white paper.
-        memset(plotterPaper,0xFF,paperSize);
+        memset(mc->plotterPaper,0xFF,paperSize);
     }
-    plotterPenX = 1500;
-    plotterPenY = plotterPaperHeight-200;
-    plotterPenDown = FALSE;
-    if ( (plotterPenSize /= 3) == 0 ) plotterPenSize = 1;
+    mc->plotterPenX = 1500;
+    mc->plotterPenY = mc->plotterPaperHeight-200;
+    mc->plotterPenDown = FALSE;
+    if ( (mc->plotterPenSize /= 3) == 0 ) mc->plotterPenSize = 1;
     if  ( verbose & 1 ) fprintf(diag, "Starting plotting\n");
 }
 
-void savePlotterPaper (void)
+void savePlotterPaper (ELLIOTT900 *mc)
 {
     char *title = "Elliott 903 Plotter Output";
     INT32 y;
@@ -1058,13 +4061,13 @@ void savePlotterPaper (void)
     png_structp png_ptr;
     png_infop info_ptr;
 
-    if  ( plotterPaper == NULL ) return;
+    if  ( mc->plotterPaper == NULL ) return;
     
 	// Open file for writing (binary mode)
-	fp = fopen(plotPath, "wb");
+	fp = fopen(mc->plotPath, "wb");
 	if  ( fp == NULL ) {
 		fprintf(stderr, ERR_FOPEN_PLOT_FILE);
-		perror(plotPath);
+		perror(mc->plotPath);
 		goto finalise;
 	}
 
@@ -1091,7 +4094,7 @@ void savePlotterPaper (void)
 	png_init_io(png_ptr, fp);
 
 	// Write header (8 bit colour depth)
-	png_set_IHDR(png_ptr, info_ptr, plotterPaperWidth, plotterPaperHeight,
+	png_set_IHDR(png_ptr, info_ptr, mc->plotterPaperWidth, mc->plotterPaperHeight,
 			8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
 			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
 
@@ -1108,8 +4111,8 @@ void savePlotterPaper (void)
 
 	// Write image data
 
-	for ( y=0 ; y<plotterPaperHeight ; y++ ) {
-		png_write_row(png_ptr, &plotterPaper[y * plotterPaperWidth * 3]);
+	for ( y=0 ; y<mc->plotterPaperHeight ; y++ ) {
+		png_write_row(png_ptr, &mc->plotterPaper[y * mc->plotterPaperWidth * 3]);
 	}
 
 	// End write
@@ -1122,191 +4125,350 @@ void savePlotterPaper (void)
 
 }
 
-void movePlotter(INT32 bits)
+void movePlotter(ELLIOTT900 *mc, INT32 bits)
 {
-  static INT32 firstCall = TRUE;
   INT32 address;
 
-  if  ( firstCall )  // Only try once !
+  if  ( ! mc->plotterStarted ) // Only try once !
     {
-       setupPlotter();
-       firstCall = FALSE;
+       setupPlotter(mc);
+       mc->plotterStarted = TRUE;
     }
 
-  if  ( plotterPaper == NULL ) return;   // Paper allocation failed.
+  if  ( mc->plotterPaper == NULL ) return; // Paper allocation failed.
 
   if  ( verbose & 8 ) fprintf(diag, "Plotter code %1o output\n", bits & 63);
 
   // hard stop at E and W margins
-  if  ( (bits & 1 ) && (plotterPenX < plotterPaperWidth ) ) 
-		     plotterPenX+=1; // East
-  if  ( (bits & 2 ) && (plotterPenX > 0 ) ) 
-		     plotterPenX-=1; // West
-  if  ( bits &  4 )  plotterPenY-=1; // North
-  if  ( bits &  8 )  plotterPenY+=1; // South
-  if  ( bits & 16 )  plotterPenDown = FALSE;
-  if  ( bits & 32 )  plotterPenDown = TRUE;
+  if  ( (bits & 1 ) && (mc->plotterPenX < mc->plotterPaperWidth ) ) 
+		     mc->plotterPenX+=1; // East
+  if  ( (bits & 2 ) && (mc->plotterPenX > 0 ) ) 
+		     mc->plotterPenX-=1; // West
+  if  ( bits &  4 )  mc->plotterPenY-=1; // North
+  if  ( bits &  8 )  mc->plotterPenY+=1; // South
+  if  ( bits & 16 )  mc->plotterPenDown = FALSE;
+  if  ( bits & 32 )  mc->plotterPenDown = TRUE;
  
-  if ( plotterPenDown )
+  if ( mc->plotterPenDown )
     {
-      for ( INT32 x = plotterPenX-plotterPenSize; x <= plotterPenX+plotterPenSize; x++ )
-	  for ( INT32 y = plotterPenY-plotterPenSize; y <= plotterPenY+plotterPenSize; y++ )
-	    if  ( (y >= 0) && ( y < plotterPaperHeight) ) // trim if outside N and S margins
+      for ( INT32 x = mc->plotterPenX-mc->plotterPenSize; x <= mc->plotterPenX+mc->plotterPenSize; x++ )
+	  for ( INT32 y = mc->plotterPenY-mc->plotterPenSize; y <= mc->plotterPenY+mc->plotterPenSize; y++ )
+	    if  ( (y >= 0) && ( y < mc->plotterPaperHeight) ) // trim if outside N and S margins
 	      {
-		address = (y*plotterPaperWidth*3)+(x*3);
+		address = (y*mc->plotterPaperWidth*3)+(x*3);
 		// Three bytes are for R,G,B.  Set all to zero for black pen.
-		plotterPaper[address++] = 0x0;
-		plotterPaper[address++] = 0x0;
-		plotterPaper[address  ] = 0x0;
+		mc->plotterPaper[address++] = 0x0;
+		mc->plotterPaper[address++] = 0x0;
+		mc->plotterPaper[address  ] = 0x0;
 	      }
     }
 }
 
 
+/**********************************************************/
+/*                   PERIPHERAL TIMING                    */
+/**********************************************************/
+
+
+// Peripherals run alongside the program.  An i/o instruction waits for its
+// device to become ready, transfers a character and leaves the device busy
+// for the time the character takes, so that the program computes while it
+// is punched or the next is read.  Each device becoming ready is an event
+// on a heap ordered by emulated time, which is only looked at by i/o
+// instructions and so costs nothing between them, unless the device
+// interrupts, when paceTime is brought forward to the event.
+
+// Add an event of type to happen at time
+void schedule (ELLIOTT900 *mc, INT64 time, INT32 type)
+{
+  INT32 i = mc->eventCount;
+
+  if   ( i == EVENTS )
+    {
+      flushTTY(mc);
+      fprintf(diag, "*** Too many events pending\n");
+      tidyExit(mc, EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  mc->eventCount++;
+  for ( ; i > 0 && mc->events[(i - 1) / 2].time > time ; i = (i - 1) / 2 )
+    mc->events[i] = mc->events[(i - 1) / 2]; // move later parents down
+  mc->events[i].time = time;
+  mc->events[i].type = type;
+  if ( interruptLevel[type - EVENT_READY] > 0 && time < mc->paceTime ) mc->paceTime = time;
+}
+
+// Make every event due by time until happen, in order of time
+void runEvents (ELLIOTT900 *mc, INT64 until)
+{
+  while ( mc->eventCount > 0 && mc->events[0].time <= until )
+    {
+      const EVENT e    = mc->events[0];
+      const EVENT last = mc->events[--mc->eventCount];
+      INT32 i = 0, child;
+
+      // sift the last event down from the top
+      while ( (child = 2 * i + 1) < mc->eventCount )
+	{
+	  if ( child + 1 < mc->eventCount && mc->events[child + 1].time < mc->events[child].time )
+	    child++;
+	  if ( mc->events[child].time >= last.time ) break;
+	  mc->events[i] = mc->events[child];
+	  i = child;
+	}
+      mc->events[i] = last;
+
+      if   ( e.type >= EVENT_READY )
+	{
+	  const INT32 level = interruptLevel[e.type - EVENT_READY];
+	  mc->busy &= ~(1 << (e.type - EVENT_READY));
+	  if ( level > 0 ) requestInterrupt(mc, level);
+	}
+    }
+}
+
+// Wait for device to become ready, then keep it busy for the time given
+// from the transfer, made as soon as it is ready, and account for the i/o
+// instruction, which runs alongside.  pending is fixed time of instructions
+// already executed which the engine has yet to add to emTime.
+void startIO (ELLIOTT900 *mc, INT32 device, INT64 busy, INT64 pending)
+{
+  INT64 now = mc->emTime + pending;
+
+  runEvents(mc, now);
+  while ( mc->busy & (1 << device) ) // wait for the next event
+    {
+      mc->ioWait += mc->events[0].time - now;
+      now = mc->events[0].time;
+      runEvents(mc, now);
+    }
+  mc->busy |= 1 << device;
+  schedule(mc, now + busy, EVENT_READY + device);
+  now += IO_TIME;
+  mc->emTime = now - pending;
+}
+
+
+/**********************************************************/
+/*                    PRIORITY LEVELS                     */
+/**********************************************************/
+
+
+// Interrupts are only taken by pace(), which the execution loops call at
+// the end of an instruction reaching paceTime, so a request with priority
+// over the level running sets paceTime to have it taken at once.
+
+// Request an interrupt on level
+void requestInterrupt (ELLIOTT900 *mc, INT32 level)
+{
+  mc->requests |= 1 << level;
+  if ( level < mc->level ) mc->paceTime = 0;
+}
+
+// Make events due by now happen, then take the interrupt of highest
+// priority requested if it has priority over the level running, leaving
+// that level suspended with its SCR and B as they are
+void takeInterrupt (ELLIOTT900 *mc)
+{
+  INT32 level = 1;
+
+  runEvents(mc, mc->emTime);
+  while ( level < mc->level && ! (mc->requests & (1 << level)) ) level++;
+  if   ( level < mc->level )
+    {
+      mc->requests &= ~(1 << level);
+      mc->active   |= 1 << level;
+      mc->level     = level;
+      mc->scReg     = SCRLEVEL(level);
+      mc->bReg      = BREGLEVEL(level);
+      mc->interrupts++;
+    }
+}
+
+// Level terminate: end the level running and return to the level of
+// highest priority still active, level 4 always being so.  A request
+// waiting for a level of higher priority than that is taken at once.
+void terminateLevel (ELLIOTT900 *mc)
+{
+  INT32 level = 1;
+
+  mc->active &= ~(1 << mc->level);
+  while ( level < 4 && ! (mc->active & (1 << level)) ) level++;
+  mc->level = level;
+  mc->scReg = SCRLEVEL(level);
+  mc->bReg  = BREGLEVEL(level);
+  if ( mc->requests & ((1 << level) - 1) ) mc->paceTime = 0;
+}
+
+// Called at a dynamic stop.  If a device is yet to request an interrupt
+// with priority over the level running, the program is waiting for it, so
+// let time pass until it does, then take it.  Returns FALSE if no such
+// interrupt can come, so that the stop ends the run.
+INT32 awaitInterrupt (ELLIOTT900 *mc)
+{
+  while ( ! (mc->requests & ((1 << mc->level) - 1)) )
+    {
+      if ( mc->eventCount == 0 ) return FALSE;
+      if ( mc->events[0].time > mc->emTime )
+	{
+	  mc->ioWait += mc->events[0].time - mc->emTime;
+	  mc->emTime  = mc->events[0].time;
+	}
+      runEvents(mc, mc->emTime);
+    }
+  pace(mc); // takes the interrupt, keeping to the wall clock if paced
+  return TRUE;
+}
+
+
 /**********************************************************/
 /*                    PAPER TAPE SYSTEM                   */
 /**********************************************************/
 
 
 /* Paper tape reader */
-INT32 readTape() {
+INT32 readTape(ELLIOTT900 *mc) {
   INT32 ch;
-  if   ( ptrFile == NULL )
+  if   ( mc->replayLog == NULL && mc->ptrFile == NULL )
     {
-      if  ( (ptrFile = fopen(ptrPath, "rb")) == NULL )
+      if  ( (mc->ptrFile = fopen(mc->ptrPath, "rb")) == NULL )
 	{
-	  flushTTY();
+	  flushTTY(mc);
           fprintf(stderr,"*** %s ", ERR_FOPEN_RDR_FILE);
-          perror(ptrPath);
-          putTTYOchar('\n');
-          tidyExit(EXIT_FAILURE);
+          perror(mc->ptrPath);
+          putTTYOchar(mc, '\n');
+          tidyExit(mc, EXIT_FAILURE);
 	  /* NOT REACHED */
         }
       else if  ( verbose & 1 )
 	{
-	  flushTTY();
-	  fprintf(diag, "Paper tape reader file %s opened\n", ptrPath);
+	  flushTTY(mc);
+	  fprintf(diag, "Paper tape reader file %s opened\n", mc->ptrPath);
 	}
     }
-  if  ( (ch = fgetc(ptrFile)) != EOF )
+  ch = ( mc->replayLog != NULL ) ? replayInput(mc, INPUT_TAPE) : fgetc(mc->ptrFile);
+  if  ( mc->recordFile != NULL ) recordInput(mc, INPUT_TAPE, ch);
+  if  ( ch != EOF )
       {
 	if  ( verbose & 8 )
 	  {
-	    flushTTY();
-	    traceOne = TRUE;
+	    flushTTY(mc);
+	    mc->traceOne = TRUE;
 	    fprintf(diag, "Paper tape character %3d read\n", ch);
 	  }
         return ch;
       }
     else
       {
-	flushTTY();
+	flushTTY(mc);
         if  ( verbose & 1 ) fprintf(diag, "Run off end of input tape\n");
-        tidyExit(EXIT_RDRSTOP);
+        tidyExit(mc, EXIT_RDRSTOP);
 	/* NOT REACHED */
       }
   return 0;   // Too keep gcc happy
 }
 
 /* paper tape punch */
-void punchTape(INT32 ch) {
-  if ( punchCount++ >= REEL )
+void punchTape(ELLIOTT900 *mc, INT32 ch) {
+  if ( mc->punchCount++ >= REEL )
     {
-      flushTTY();
+      flushTTY(mc);
       fprintf(diag,"Excessive output to punch\n");
-      exit(EXIT_PUNSTOP);
+      stopMachine(mc, EXIT_PUNSTOP);
       /* NOT REACHED */
     }
-  if  ( punFile == NULL )
+  if  ( mc->punFile == NULL )
     {
-      if  ( (punFile = fopen(punPath, "wb")) == NULL )
+      if  ( (mc->punFile = fopen(mc->punPath, "wb")) == NULL )
 	{
-	  flushTTY();
+	  flushTTY(mc);
 	  printf("*** %s ", ERR_FOPEN_PUN_FILE);
 	  perror("punPath");
-	  putTTYOchar('\n');
-	  tidyExit(EXIT_FAILURE);
+	  putTTYOchar(mc, '\n');
+	  tidyExit(mc, EXIT_FAILURE);
 	  /* NOT REACHED */
 	}
       else if  ( verbose & 1 )
 	{
-	  flushTTY();
-	 fprintf(diag, "Paper tape punch file %s opened\n", punPath);
+	  flushTTY(mc);
+	 fprintf(diag, "Paper tape punch file %s opened\n", mc->punPath);
 	}
     }
-  if  ( fputc(ch, punFile) != ch )
+  if  ( fputc(ch, mc->punFile) != ch )
     {
-      flushTTY();
+      flushTTY(mc);
       printf("*** Problem writing to ");
-      perror(punPath);
-      putTTYOchar('\n');
-      tidyExit(EXIT_FAILURE);
+      perror(mc->punPath);
+      putTTYOchar(mc, '\n');
+      tidyExit(mc, EXIT_FAILURE);
       /* NOT REACHED */
     }
   if  ( verbose & 8 )
     {
-      flushTTY();
-      traceOne = TRUE;
+      flushTTY(mc);
+      mc->traceOne = TRUE;
       fprintf(diag, "Paper tape character %d punched\n", ch);
     }
 }
 
 /* Teletype */
-INT32 readTTY() {
+INT32 readTTY(ELLIOTT900 *mc) {
   INT32 ch;
-  if   ( ttyCount++ >= REEL )
+  if   ( mc->ttyCount++ >= REEL )
     {
-      flushTTY();
+      flushTTY(mc);
       fprintf(stderr,"Excessive output to teletype\n");
-      exit(EXIT_PUNSTOP);
+      stopMachine(mc, EXIT_PUNSTOP);
       /* NOT REACHED */
     }
-  if   ( ttyiFile == NULL )
+  if   ( mc->replayLog == NULL && mc->ttyiFile == NULL )
     {
-      if  ( (ttyiFile = fopen(ttyInPath, "rb")) == NULL )
+      if  ( (mc->ttyiFile = fopen(mc->ttyInPath, "rb")) == NULL )
 	{
-	  flushTTY();
+	  flushTTY(mc);
           printf("*** %s ", ERR_FOPEN_TTYIN_FILE);
-          perror(ttyInPath);
-          putTTYOchar('\n');
-          tidyExit(EXIT_FAILURE);
+          perror(mc->ttyInPath);
+          putTTYOchar(mc, '\n');
+          tidyExit(mc, EXIT_FAILURE);
 	  /* NOT REACHED */
         }
       else if ( verbose & 1 )
 	{
-	  flushTTY();
+	  flushTTY(mc);
 	  fprintf(diag,"Teletype input file %s opened\n", TTYIN_FILE);
 	}
     }
-    if  ( (ch = fgetc(ttyiFile)) != EOF )
+    ch = ( mc->replayLog != NULL ) ? replayInput(mc, INPUT_TTY) : fgetc(mc->ttyiFile);
+    if  ( mc->recordFile != NULL ) recordInput(mc, INPUT_TTY, ch);
+    if  ( ch != EOF )
       {
 	if ( verbose & 8 )
 	  {
-	    flushTTY();
-	    traceOne = TRUE;
+	    flushTTY(mc);
+	    mc->traceOne = TRUE;
 	    fprintf(diag, "Read character %d from teletype\n", ch);
 	  }
-	putTTYOchar(ch); // local echoing assumed
+	putTTYOchar(mc, ch); // local echoing assumed
         return ch;
       }
     else
       {
         if  ( verbose & 1 )
 	  {
-	    flushTTY();
+	    flushTTY(mc);
 	    fprintf(diag, "Run off end of teleprinter input\n");
 	  }
-        tidyExit(EXIT_TTYSTOP);
+        tidyExit(mc, EXIT_TTYSTOP);
       }
     return 0;   // Too keep gcc happy
 }
 
-void writeTTY(INT32 ch) {
+void writeTTY(ELLIOTT900 *mc, INT32 ch) {
   INT32 ch2 = ( ((ch &= 127) == 10 ) || ((ch >= 32) && (ch <= 122)) ? ch : -1 );
   if  ( verbose & 8 )
     {
-      flushTTY();
-      traceOne = TRUE;
+      flushTTY(mc);
+      mc->traceOne = TRUE;
       fprintf(diag, "Character %d output to teletype", ch);
       if  ( ch2 == -1 )
 	fprintf(diag, " - ignored\n");
@@ -1314,14 +4476,14 @@ void writeTTY(INT32 ch) {
 	fprintf(diag, "(%c)\n", ch2);
     }
   if  ( ch2 != -1 )
-      putTTYOchar((lastttych = ch2));
+      putTTYOchar(mc, (mc->lastttych = ch2));
 }
 
-void flushTTY() {
-  if  ( (lastttych != -1) && (lastttych != '\n') )
+void flushTTY(ELLIOTT900 *mc) {
+  if  ( (mc->lastttych != -1) && (mc->lastttych != '\n') )
     {
-      putTTYOchar('\n');
-      lastttych = -1;
+      putTTYOchar(mc, '\n');
+      mc->lastttych = -1;
     }
 }
 
@@ -1330,19 +4492,19 @@ void flushTTY() {
 /**********************************************************/
 
 
-void loadII() {
-  store[8180] = (-3 & MASK18);
-  store[8181] = makeIns(0,  0, 8180);
-  store[8182] = makeIns(0,  4, 8189);
-  store[8183] = makeIns(0, 15, 2048);
-  store[8184] = makeIns(0,  9, 8186);
-  store[8185] = makeIns(0,  8, 8183);
-  store[8186] = makeIns(0, 15, 2048);
-  store[8187] = makeIns(1,  5, 8180);
-  store[8188] = makeIns(0, 10,    1);
-  store[8189] = makeIns(0,  4,    1);
-  store[8190] = makeIns(0,  9, 8182);
-  store[8191] = makeIns(0,  8, 8177);
+void loadII(ELLIOTT900 *mc) {
+  mc->store[8180] = (-3 & MASK18);
+  mc->store[8181] = makeIns(0,  0, 8180);
+  mc->store[8182] = makeIns(0,  4, 8189);
+  mc->store[8183] = makeIns(0, 15, 2048);
+  mc->store[8184] = makeIns(0,  9, 8186);
+  mc->store[8185] = makeIns(0,  8, 8183);
+  mc->store[8186] = makeIns(0, 15, 2048);
+  mc->store[8187] = makeIns(1,  5, 8180);
+  mc->store[8188] = makeIns(0, 10,    1);
+  mc->store[8189] = makeIns(0,  4,    1);
+  mc->store[8190] = makeIns(0,  9, 8182);
+  mc->store[8191] = makeIns(0,  8, 8177);
   if  ( verbose & 1 )
     fprintf(diag, "Initial orders loaded\n");
 }
@@ -1351,8 +4513,9 @@ INT32 makeIns(INT32 m, INT32 f, INT32 a) {
   return ((m << 17) | (f << 13) | a);
 }
 
-void putTTYOchar (char ch)
+void putTTYOchar (ELLIOTT900 *mc, char ch)
 {
-  putchar(ch);
+  if ( mc->iCount > mc->outputTo ) // not sent before reverse execution
+    fputc(ch, mc->ttyoFile);
 //***MJB redirect to pipe for screen display  
 }
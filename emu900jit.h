@@ -0,0 +1,442 @@
+// Elliott 903 emulator - native x86-64 code for translated blocks
+
+// This file is included once by emu900.c.  With -engine=3 (ENGINE_NATIVE) a
+// translated block executed JIT_THRESHOLD times is compiled to an x86-64
+// function returning the number of its micro-ops executed.  Each machine has its own code, in
+// which the addresses of its store and registers are constants.  The
+// function keeps the machine state in registers:
+//
+//    rbx  -- store            r12d -- A register
+//    r15  -- decoded          r13d -- Q register
+//    rbp  -- bReg             r14  -- count of stores made
+//
+// Loads, stores to fixed addresses and jumps are compiled inline, with
+// results masked to 18 bits and B modified addresses to 16 bits as in
+// emu900ops.h.  Everything else (multiply, divide, shift, i/o, stores to
+// B modified addresses, references to the SCR and B locations and stores
+// into the initial instructions) calls jitStep(), which runs the micro-op
+// through the same function code handlers as the block interpreter.
+//
+// As in runBlock(), a store into a translated block discards it and the
+// compiled code is left after the store.  The fixed time, instruction and
+// function code counts are accounted by accountBlock() from the number of
+// micro-ops executed.  The compiled code only adds time depending on data.
+
+#if JIT_HOST
+
+#include <stddef.h>
+
+#define CODE_SIZE   (4 << 20) // bytes of native code
+#define CODE_PER_OP       192 // most bytes compiled for one micro-op
+#define CODE_PER_BLOCK    128 //   ... and for a block's entry and exit
+
+
+// append bytes of code to the native code of mc
+#define EMIT(...)							\
+  {									\
+    const unsigned char bytes_[] = { __VA_ARGS__ };			\
+    memcpy(mc->cp, bytes_, sizeof(bytes_));				\
+    mc->cp += sizeof(bytes_);						\
+  }
+
+static void emit4 (ELLIOTT900 *mc, INT32 value)
+{
+  memcpy(mc->cp, &value, 4);
+  mc->cp += 4;
+}
+
+static void emit8 (ELLIOTT900 *mc, const void *value)
+{
+  const uint64_t v = (uint64_t) (uintptr_t) value;
+  memcpy(mc->cp, &v, 8);
+  mc->cp += 8;
+}
+
+// short forward jump with opcode op, returning the displacement to patch
+static unsigned char *jumpForward (ELLIOTT900 *mc, INT32 op)
+{
+  EMIT(op, 0);
+  return mc->cp - 1;
+}
+
+// patch displacement of a short forward jump to reach cp
+static void land (ELLIOTT900 *mc, unsigned char *disp)
+{
+  *disp = mc->cp - (disp + 1);
+}
+
+// modrm (and sib or displacement) for reg with operand store[m], where m
+// is in ecx if B modified, otherwise the constant m
+static void emitOperand (ELLIOTT900 *mc, INT32 reg, INT32 bMod, INT32 m)
+{
+  if   ( bMod )
+    EMIT(0x04 | (reg << 3), 0x8B) // [rbx+rcx*4]
+  else
+    {
+      EMIT(0x83 | (reg << 3));    // [rbx+disp32]
+      emit4(mc, m * 4);
+    }
+}
+
+// ecx = (a + B) & MASK16
+static void emitModify (ELLIOTT900 *mc, INT32 a)
+{
+  EMIT(0x8B, 0x0C, 0xAB);         // mov ecx,[rbx+rbp*4]
+  EMIT(0x81, 0xC1); emit4(mc, a); // add ecx,a
+  EMIT(0x81, 0xE1); emit4(mc, MASK16); // and ecx,MASK16
+}
+
+// store[scReg] = ecx if B modified, otherwise the constant m
+static void emitSetSCR (ELLIOTT900 *mc, INT32 bMod, INT32 m)
+{
+  EMIT(0x48, 0xB8); emit8(mc, &mc->scReg); // mov rax,&scReg
+  EMIT(0x48, 0x63, 0x00);         // movsxd rax,[rax]
+  if   ( bMod )
+    EMIT(0x89, 0x0C, 0x83)        // mov [rbx+rax*4],ecx
+  else
+    {
+      EMIT(0xC7, 0x04, 0x83);     // mov dword [rbx+rax*4],m
+      emit4(mc, m);
+    }
+}
+
+static void emitAddTime (ELLIOTT900 *mc, INT32 us)
+{
+  EMIT(0x48, 0xB8); emit8(mc, &mc->emTime); // mov rax,&emTime
+  EMIT(0x48, 0x81, 0x00); emit4(mc, us); // add qword [rax],us
+}
+
+// leave compiled code having executed n micro-ops
+static void emitExit (ELLIOTT900 *mc, INT32 n)
+{
+  EMIT(0xB8); emit4(mc, n);       // mov eax,n
+  EMIT(0xE9); emit4(mc, mc->codeExit - (mc->cp + 4)); // jmp codeExit
+}
+
+// A and Q to and from mc around calls to C
+static void emitSaveAQ (ELLIOTT900 *mc)
+{
+  EMIT(0x48, 0xBA); emit8(mc, &mc->aReg); // mov rdx,&aReg
+  EMIT(0x44, 0x89, 0x22);         // mov [rdx],r12d
+  EMIT(0x48, 0xBA); emit8(mc, &mc->qReg); // mov rdx,&qReg
+  EMIT(0x44, 0x89, 0x2A);         // mov [rdx],r13d
+}
+
+static void emitLoadAQ (ELLIOTT900 *mc)
+{
+  EMIT(0x48, 0xBA); emit8(mc, &mc->aReg); // mov rdx,&aReg
+  EMIT(0x44, 0x8B, 0x22);         // mov r12d,[rdx]
+  EMIT(0x48, 0xBA); emit8(mc, &mc->qReg); // mov rdx,&qReg
+  EMIT(0x44, 0x8B, 0x2A);         // mov r13d,[rdx]
+}
+
+// run micro-op i of blk through jitStep(), leaving if it is the last or
+// jitStep() says the block must be left
+static void emitStep (ELLIOTT900 *mc, BLOCK *blk, INT32 i, INT32 last)
+{
+  unsigned char *stay;
+
+  emitSaveAQ(mc);
+  EMIT(0x48, 0xBF); emit8(mc, mc);  // mov rdi,mc
+  EMIT(0x48, 0xBE); emit8(mc, blk); // mov rsi,blk
+  EMIT(0xBA); emit4(mc, i);         // mov edx,i
+  EMIT(0x48, 0xB8); emit8(mc, jitStep); // mov rax,jitStep
+  EMIT(0xFF, 0xD0);               // call rax
+  emitLoadAQ(mc);
+  EMIT(0x48, 0xBA); emit8(mc, &mc->bReg); // mov rdx,&bReg
+  EMIT(0x48, 0x63, 0x2A);         // movsxd rbp,[rdx]
+  if   ( ! last )
+    {
+      EMIT(0x85, 0xC0);           // test eax,eax
+      stay = jumpForward(mc, 0x74); // jz stay
+      emitExit(mc, i + 1);
+      land(mc, stay);
+    }
+  else
+    emitExit(mc, i + 1);
+}
+
+// account for a store into constant address m by micro-op i at addr,
+// leaving if it discards blk
+static void emitInvalidate (ELLIOTT900 *mc, BLOCK *blk, INT32 i, INT32 addr, INT32 m)
+{
+  unsigned char *notInBlock, *stillValid;
+
+  EMIT(0x49, 0xFF, 0xC6);         // inc r14
+  EMIT(0x41, 0xC6, 0x87);         // mov byte [r15+valid],0
+  emit4(mc, m * sizeof(DECODED) + offsetof(DECODED, valid)); EMIT(0);
+  EMIT(0x41, 0x80, 0xBF);         // cmp byte [r15+inBlock],0
+  emit4(mc, m * sizeof(DECODED) + offsetof(DECODED, inBlock)); EMIT(0);
+  notInBlock = jumpForward(mc, 0x74); // je notInBlock
+  EMIT(0x48, 0xBF); emit8(mc, mc);  // mov rdi,mc
+  EMIT(0xBE); emit4(mc, m);         // mov esi,m
+  EMIT(0x48, 0xB8); emit8(mc, invalidateBlocks);
+  EMIT(0xFF, 0xD0);               // call invalidateBlocks
+  EMIT(0x48, 0xB8); emit8(mc, &blk->valid);
+  EMIT(0x83, 0x38, 0x00);         // cmp dword [rax],0
+  stillValid = jumpForward(mc, 0x75); // jne stillValid
+  emitSetSCR(mc, FALSE, addr + 1);
+  emitExit(mc, i + 1);
+  land(mc, notInBlock);
+  land(mc, stillValid);
+}
+
+// compile micro-op i of blk, at addr
+static void compileOp (ELLIOTT900 *mc, BLOCK *blk, INT32 i, INT32 addr)
+{
+  const UOP  *op   = &blk->ops[i];
+  const INT32 n    = blk->length;
+  const INT32 last = ( i == n - 1 );
+  const INT32 bMod = op->bMod;
+  const INT32 m    = op->a & MASK16;
+  unsigned char *inStore, *done, *skip;
+
+  switch ( op->f )
+    {
+    case 0: case 1: case 2: case 4: case 6: // loads
+      if   ( ! bMod && m < REG_LOCS )
+	{
+	  emitStep(mc, blk, i, last); // SCR or B, not up to date in store
+	  return;
+	}
+      done = NULL;
+      if   ( bMod )
+	{
+	  emitModify(mc, op->a);
+	  EMIT(0x81, 0xF9); emit4(mc, REG_LOCS); // cmp ecx,REG_LOCS
+	  inStore = jumpForward(mc, 0x73);    // jae inStore
+	  emitStep(mc, blk, i, last);
+	  if ( ! last ) done = jumpForward(mc, 0xEB); // jmp done
+	  land(mc, inStore);
+	}
+      switch ( op->f )
+	{
+	case 0: // Load B
+	  EMIT(0x44, 0x8B); emitOperand(mc, 5, bMod, m); // mov r13d,store[m]
+	  EMIT(0x44, 0x89, 0x2C, 0xAB);               // mov [rbx+rbp*4],r13d
+	  break;
+	case 1: // Add
+	  EMIT(0x44, 0x03); emitOperand(mc, 4, bMod, m); // add r12d,store[m]
+	  EMIT(0x41, 0x81, 0xE4); emit4(mc, MASK18);  // and r12d,MASK18
+	  break;
+	case 2: // Negate and add
+	  EMIT(0x8B); emitOperand(mc, 0, bMod, m);   // mov eax,store[m]
+	  EMIT(0x44, 0x29, 0xE0);                     // sub eax,r12d
+	  EMIT(0x25); emit4(mc, MASK18);              // and eax,MASK18
+	  EMIT(0x41, 0x89, 0xC4);                     // mov r12d,eax
+	  break;
+	case 4: // Load A
+	  EMIT(0x44, 0x8B); emitOperand(mc, 4, bMod, m); // mov r12d,store[m]
+	  break;
+	case 6: // Collate
+	  EMIT(0x44, 0x23); emitOperand(mc, 4, bMod, m); // and r12d,store[m]
+	  break;
+	}
+      if ( done != NULL ) land(mc, done);
+      break;
+
+    case 3: case 5: case 10: case 11: // stores
+      if   ( bMod || m < REG_LOCS || ( op->f == 5 && m >= 8180 && m <= 8191 ) )
+	{
+	  emitStep(mc, blk, i, last); // B modified, SCR or B, or initial instructions
+	  return;
+	}
+      switch ( op->f )
+	{
+	case 3: // Store Q
+	  EMIT(0x44, 0x89, 0xE8);                     // mov eax,r13d
+	  EMIT(0xD1, 0xE8);                           // shr eax,1
+	  EMIT(0x89); emitOperand(mc, 0, FALSE, m);  // mov store[m],eax
+	  break;
+	case 5: // Store A
+	  EMIT(0x44, 0x89); emitOperand(mc, 4, FALSE, m); // mov store[m],r12d
+	  break;
+	case 10: // Increment in store
+	  EMIT(0x8B); emitOperand(mc, 0, FALSE, m);  // mov eax,store[m]
+	  EMIT(0xFF, 0xC0);                           // inc eax
+	  EMIT(0x25); emit4(mc, MASK18);              // and eax,MASK18
+	  EMIT(0x89); emitOperand(mc, 0, FALSE, m);  // mov store[m],eax
+	  break;
+	case 11: // Store S, SCR being addr + 1
+	  EMIT(0x41, 0xBD); emit4(mc, (addr + 1) & MOD_MASK); // mov r13d,...
+	  EMIT(0xC7); emitOperand(mc, 0, FALSE, m);       // mov store[m],...
+	  emit4(mc, (addr + 1) & ADDR_MASK);
+	  break;
+	}
+      emitInvalidate(mc, blk, i, addr, m);
+      break;
+
+    case 7: // Jump if zero
+      if ( bMod ) emitModify(mc, op->a);
+      EMIT(0x45, 0x85, 0xE4);                 // test r12d,r12d
+      skip = jumpForward(mc, 0x75);           // jnz skip
+      emitAddTime(mc, 28);
+      emitSetSCR(mc, bMod, m);
+      emitExit(mc, n);
+      land(mc, skip);
+      emitAddTime(mc, 1);                     // 21us when not taken
+      emitSetSCR(mc, FALSE, addr + 1);
+      emitExit(mc, n);
+      return;
+
+    case 8: // Jump unconditional
+      if ( bMod ) emitModify(mc, op->a);
+      emitSetSCR(mc, bMod, m);
+      emitExit(mc, n);
+      return;
+
+    case 9: // Jump if negative
+      if ( bMod ) emitModify(mc, op->a);
+      EMIT(0x41, 0x0F, 0xBA, 0xE4, 17);       // bt r12d,17
+      skip = jumpForward(mc, 0x73);           // jnc skip
+      emitAddTime(mc, 25);
+      emitSetSCR(mc, bMod, m);
+      emitExit(mc, n);
+      land(mc, skip);
+      emitSetSCR(mc, FALSE, addr + 1);
+      emitExit(mc, n);
+      return;
+
+    default: // multiply, divide, shift and i/o
+      emitStep(mc, blk, i, last);
+      return;
+    }
+
+  if   ( last ) // block ended without a jump
+    {
+      emitSetSCR(mc, FALSE, addr + 1);
+      emitExit(mc, n);
+    }
+}
+
+// Set the protection of the pages of native code holding from up to to,
+// which are writable only while being compiled, otherwise only executable
+static void protectCode (unsigned char *from, unsigned char *to, INT32 prot)
+{
+  const uintptr_t page  = sysconf(_SC_PAGESIZE);
+  const uintptr_t first = (uintptr_t) from & ~(page - 1);
+  const uintptr_t end   = ((uintptr_t) to + page - 1) & ~(page - 1);
+
+  if   ( mprotect((void *) first, end - first, prot) != 0 )
+    {
+      perror("*** Cannot protect native code");
+      exit(EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+}
+
+// Compile translated block blk starting at start
+void compileBlock (ELLIOTT900 *mc, BLOCK *blk, INT32 start)
+{
+  unsigned char *entry, *limit;
+
+  if   ( mc->cp + CODE_PER_BLOCK + blk->length * CODE_PER_OP > mc->code + CODE_SIZE )
+    flushNative(mc);
+  entry = mc->cp;
+  limit = entry + CODE_PER_BLOCK + blk->length * CODE_PER_OP;
+  protectCode(entry, limit, PROT_READ | PROT_WRITE);
+  blk->native = (INT32 (*)()) mc->cp;
+
+  EMIT(0x53, 0x55, 0x41, 0x54, 0x41, 0x55, // push rbx,rbp,r12,r13
+       0x41, 0x56, 0x41, 0x57,             // push r14,r15
+       0x48, 0x83, 0xEC, 0x08);            // sub rsp,8
+  EMIT(0x48, 0xBB); emit8(mc, mc->store);  // mov rbx,store
+  EMIT(0x49, 0xBF); emit8(mc, mc->decoded); // mov r15,decoded
+  emitLoadAQ(mc);
+  EMIT(0x48, 0xB8); emit8(mc, &mc->bReg);  // mov rax,&bReg
+  EMIT(0x48, 0x63, 0x28);                  // movsxd rbp,[rax]
+  EMIT(0x45, 0x31, 0xF6);                  // xor r14d,r14d
+
+  for ( INT32 i = 0 ; i < blk->length ; i++ )
+    compileOp(mc, blk, i, start + i);
+  protectCode(entry, limit, PROT_READ | PROT_EXEC);
+  mc->blocksCompiled++;
+}
+
+// Allocate space for native code and compile the exit common to all blocks,
+// which returns the count of micro-ops executed left in eax.  No page is
+// ever both writable and executable.
+void initNative (ELLIOTT900 *mc)
+{
+  mc->code = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if   ( mc->code == MAP_FAILED )
+    {
+      perror("*** Cannot allocate space for native code");
+      exit(EXIT_FAILURE);
+      /* NOT REACHED */
+    }
+  mc->codeExit = mc->cp = mc->code;
+  emitSaveAQ(mc);
+  EMIT(0x48, 0xBA); emit8(mc, &mc->storeWrites); // mov rdx,&storeWrites
+  EMIT(0x4C, 0x01, 0x32);                  // add [rdx],r14
+  EMIT(0x48, 0x83, 0xC4, 0x08,             // add rsp,8
+       0x41, 0x5F, 0x41, 0x5E,             // pop r15,r14
+       0x41, 0x5D, 0x41, 0x5C,             // pop r13,r12
+       0x5D, 0x5B, 0xC3);                  // pop rbp,rbx; ret
+  mc->codeStart = mc->cp;
+  protectCode(mc->code, mc->code + CODE_SIZE, PROT_READ | PROT_EXEC);
+}
+
+void freeNative (ELLIOTT900 *mc)
+{
+  munmap(mc->code, CODE_SIZE);
+  mc->code = NULL;
+}
+
+// Discard all native code once space runs out
+void flushNative (ELLIOTT900 *mc)
+{
+  for ( INT32 i = 0 ; i < STORE_SIZE ; i++ )
+    {
+      mc->blocks[i].native = NULL;
+      mc->blocks[i].hits   = 0;
+    }
+  mc->cp = mc->codeStart;
+}
+
+#else // ! JIT_HOST
+
+void compileBlock (ELLIOTT900 *mc, BLOCK *blk, INT32 start) { }
+void initNative (ELLIOTT900 *mc) { }
+void freeNative (ELLIOTT900 *mc) { }
+void flushNative (ELLIOTT900 *mc) { }
+
+#endif
+
+// Execute micro-op i of blk through the function code handlers on behalf of
+// compiled code.  Returns TRUE if the block must be left.
+INT32 jitStep (ELLIOTT900 *mc, BLOCK *blk, INT32 i)
+{
+  const UOP  *op = &blk->ops[i];
+  const INT32 pc = (blk - mc->blocks) + i + 1;
+
+  mc->lastSCR = pc - 1;
+  mc->store[mc->scReg] = pc;
+  mc->instruction = op->instruction;
+  mc->f = op->f;
+  mc->a = op->a;
+  if ( op->bMod )
+    mc->m = (mc->a + mc->store[mc->bReg]) & MASK16;
+  else
+    mc->m = mc->a & MASK16;
+
+  switch ( mc->f )
+    {
+#define RUN_CASE(n) case n
+#define RUN_NEXT    break
+#define RUN_TIME(n)
+#define RUN_SYNC    accountBlock(mc, blk, op + 1, TRUE)
+#define RUN_COUNT   (mc->iCount + i + 1)
+#define RUN_PENDING op->time
+#include "emu900ops.h"
+#undef  RUN_CASE
+#undef  RUN_NEXT
+#undef  RUN_TIME
+#undef  RUN_SYNC
+#undef  RUN_COUNT
+#undef  RUN_PENDING
+    }
+
+  return ( ! blk->valid || mc->store[mc->scReg] != pc );
+}
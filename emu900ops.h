@@ -0,0 +1,247 @@
+// Elliott 903 emulator - function code handlers
+
+// Included inside the dispatch of each execution engine.  Expects mc to
+// point to the machine being run, with its f, a, m, instruction and lastSCR
+// set up for the current instruction, and the includer to define:
+//
+//    RUN_CASE(n)   -- label for the handler of function code n
+//    RUN_NEXT      -- statement ending each handler
+//    RUN_TIME(n)   -- account for the fixed time of function code n, which
+//                     translated blocks add once per block instead
+//    RUN_SYNC      -- bring iCount up to date before reporting an error
+//    RUN_COUNT     -- instruction count of the current instruction, which
+//                     translated blocks only add to iCount once per block
+//    RUN_PENDING   -- fixed time of instructions up to the current one that
+//                     translated blocks have yet to add to emTime
+//
+// Time which depends on the data (jumps taken, shift places and i/o) is
+// always added by the handler itself, i/o taking as long as it waits for
+// its device (see startIO()).
+//
+// Every store into the store goes through INVALIDATE so that predecoded
+// instructions and translated blocks are discarded when code is modified,
+// and through WATCH so that watchpoints are checked.
+// Operand addresses are not checked here: any m beyond the available store
+// falls in the guard pages following it (see allocateStore()).
+
+        RUN_CASE(0): // Load B
+	    mc->qReg = mc->store[mc->m]; mc->store[mc->bReg] = mc->qReg; // B is never predecoded
+	    WATCH(mc->bReg);
+	    RUN_TIME(0);
+	    RUN_NEXT;
+
+          RUN_CASE(1): // Add
+       	    mc->aReg = (mc->aReg + mc->store[mc->m]) & MASK18;
+	    RUN_TIME(1);
+	    RUN_NEXT;
+
+          RUN_CASE(2): // Negate and add
+	    mc->aReg = (mc->store[mc->m] - mc->aReg) & MASK18;
+	    RUN_TIME(2);
+	    RUN_NEXT;
+
+          RUN_CASE(3): // Store Q
+	    mc->store[mc->m] = mc->qReg >> 1;
+	    INVALIDATE(mc->m);
+	    WATCH(mc->m);
+	    RUN_TIME(3);
+	    RUN_NEXT;
+
+          RUN_CASE(4): // Load A
+	    mc->aReg = mc->store[mc->m];
+	    RUN_TIME(4);
+	    RUN_NEXT;
+
+          RUN_CASE(5): // Store A
+	    if   ( mc->level == 1 && mc->m >= 8180 && mc->m <= 8191 )
+	      {
+		if ( verbose & 1 )
+	            fprintf(diag,
+		      "Write to initial instructions ignored in priority level 1");
+	      }
+	    else
+	      {
+	        mc->store[mc->m] = mc->aReg;
+		INVALIDATE(mc->m);
+		WATCH(mc->m);
+	      }
+	    RUN_TIME(5);
+	    RUN_NEXT;
+
+          RUN_CASE(6): // Collate
+	    mc->aReg &= mc->store[mc->m];
+	    RUN_TIME(6);
+	    RUN_NEXT;
+
+          RUN_CASE(7): // Jump if zero
+	    RUN_TIME(7);
+  	    if   ( mc->aReg == 0 )
+	      {
+	        mc->traceOne = mc->tracing && (verbose & 2);
+	        mc->store[mc->scReg] = mc->m;
+		mc->emTime += 28;
+	      }
+	    if  ( mc->aReg > 0 )
+	      mc->emTime += 1; // 21us rather than 20us when positive
+	    RUN_NEXT;
+
+          RUN_CASE(8): // Jump unconditional
+	    mc->store[mc->scReg] = mc->m;
+	    RUN_TIME(8);
+	    RUN_NEXT;
+
+          RUN_CASE(9): // Jump if negative
+	    if   ( mc->aReg >= BIT18 )
+	      {
+	        mc->traceOne = mc->tracing && (verbose & 2);
+		mc->store[mc->scReg] = mc->m;
+		mc->emTime += 25;
+	      }
+	    RUN_TIME(9);
+	    RUN_NEXT;
+
+          RUN_CASE(10): // increment in store
+ 	    mc->store[mc->m] = (mc->store[mc->m] + 1) & MASK18;
+	    INVALIDATE(mc->m);
+	    WATCH(mc->m);
+	    RUN_TIME(10);
+	    RUN_NEXT;
+
+          RUN_CASE(11):  // Store S
+	    {
+	      mc->qReg = mc->store[mc->scReg] & MOD_MASK;
+	      mc->store[mc->m] = mc->store[mc->scReg] & ADDR_MASK;
+	      INVALIDATE(mc->m);
+	      WATCH(mc->m);
+	      RUN_TIME(11);
+	      RUN_NEXT;
+	    }
+
+          RUN_CASE(12):  // Multiply
+	    {
+	      {
+	        // extend sign bits for a and store[m]
+	        const INT64 al = (INT64) ( ( mc->aReg >= BIT18 ) ? mc->aReg - BIT19 : mc->aReg );
+	        const INT64 sl = (INT64) ( ( mc->store[mc->m] >= BIT18 ) ? mc->store[mc->m] - BIT19 : mc->store[mc->m] );
+	        INT64  prod = al * sl;
+	        mc->qReg = (INT32) ((prod << 1) & MASK18 );
+	        if   ( al < 0 ) mc->qReg |= 1;
+	        prod = prod >> 17; // arithmetic shift
+ 	        mc->aReg = (int) (prod & MASK18);
+	        RUN_TIME(12);
+	        RUN_NEXT;
+	      }
+	    }
+
+          RUN_CASE(13):  // Divide
+	    {
+	      {
+	        // extend sign bit for aq
+	        const INT64 al   = (INT64) ( ( mc->aReg >= BIT18 ) ? mc->aReg - BIT19 : mc->aReg ); // sign extend
+	        const INT64 ql   = (INT64) mc->qReg;
+	        const INT64 aql  = (al << 18) | ql;
+	        const INT64 ml   = (INT64) ( ( mc->store[mc->m] >= BIT18 ) ? mc->store[mc->m] - BIT19 : mc->store[mc->m] );
+                const INT64 quot = (( aql / ml) >> 1) & MASK18;
+	        const INT32 q     = (INT32) quot;
+  	        mc->aReg = q | 1;
+	        mc->qReg = q & 0777776;
+	        RUN_TIME(13);
+	        RUN_NEXT;
+	      }
+	    }
+
+          RUN_CASE(14):  // Shift - assumes >> applied to a signed long or int is arithmetic
+	    {
+              INT32       places = mc->m & ADDR_MASK;
+	      const INT64 al  = (INT64) ( ( mc->aReg >= BIT18 ) ? mc->aReg - BIT19 : mc->aReg ); // sign extend
+	      const INT64 ql  = mc->qReg;
+	      INT64       aql = (al << 18) | ql;
+
+	      if   ( places <= 2047 )
+	        {
+		  mc->emTime += (24 + 7 * places);
+	          if   ( places >= 36 ) places = 36;
+	          aql <<= places;
+	        }
+	      else if ( places >= 6144 )
+	        { // right shift is arithmetic
+	          places = 8192 - places;
+		  mc->emTime += (24 + 7 * places);
+	          if ( places >= 36 ) places = 36;
+		  aql >>= places;
+	        }
+	      else
+	        {
+		  RUN_SYNC;
+		  flushTTY(mc);
+	          fprintf(diag, "*** Unsupported i/o 14 i/o instruction\n");
+	          printDiagnostics(mc);
+	          tidyExit(mc, EXIT_FAILURE);
+	          /* NOT REACHED */
+	        }
+
+	      mc->qReg = (int) (aql & MASK18);
+	      mc->aReg = (int) ((aql >> 18) & MASK18);
+	      RUN_NEXT;
+	    }
+
+            RUN_CASE(15):  // Input/output etc
+	      {
+                const INT32 z = mc->m & ADDR_MASK;
+		mc->ioCount++;
+	        switch   ( z )
+	    	  {
+
+		    case 2048: // read from tape reader
+		      {
+	                INT32 ch;
+			startIO(mc, DEV_READER, READER_TIME, RUN_PENDING);
+			mc->inputAt = RUN_COUNT;
+			ch = readTape(mc);
+	                mc->aReg = ((mc->aReg << 7) | ch) & MASK18;
+	                break;
+	               }
+
+	            case 2052: // read from teletype
+		      {
+	                INT32 ch;
+			startIO(mc, DEV_TTYIN, TTYIN_TIME, RUN_PENDING);
+			mc->inputAt = RUN_COUNT;
+			ch = readTTY(mc);
+	                mc->aReg = ((mc->aReg << 7) | ch) & MASK18;
+	                break;
+	              }
+
+		  case 4864: // send to plotter
+
+		      startIO(mc, DEV_PLOTTER,
+			      ( mc->aReg >= 16 ) ? PLOT_PEN_TIME : PLOT_STEP_TIME,
+			      RUN_PENDING);
+		      movePlotter(mc, mc->aReg);
+		      break;
+
+	            case 6144: // write to paper tape punch
+		      startIO(mc, DEV_PUNCH, PUNCH_TIME, RUN_PENDING);
+	              punchTape(mc, mc->aReg & 255);
+	              break;
+
+	            case 6148: // write to teletype
+		      startIO(mc, DEV_TTYOUT, TTYOUT_TIME, RUN_PENDING);
+	              writeTTY(mc, mc->aReg & 255);
+	              break;
+
+	            case 7168:  // Level terminate
+		      terminateLevel(mc);
+		      mc->emTime += 19;
+	              break;
+
+	            default:
+		      RUN_SYNC;
+		      flushTTY(mc);
+	              fprintf(diag, "*** Unsupported 15 i/o instruction\n");
+	              printDiagnostics(mc);
+	              tidyExit(mc, EXIT_FAILURE);
+	              /* NOT REACHED */
+		  } // end 15 switch
+		RUN_NEXT;
+	      } // end case 15
@@ -0,0 +1,136 @@
+// Elliott 903 emulator - instruction execution loop
+
+// This file is included by emu900.c once for each execution engine.  Before
+// each inclusion the following must be defined:
+//
+//    RUN_NAME      -- name of the function to generate
+//    RUN_THREADED  -- 0 for dispatch through a single switch on the function
+//                     code, 1 for direct threaded dispatch using computed
+//                     gotos (GCC "labels as values")
+//    RUN_STEP      -- 1 to execute a single instruction only (switch form)
+//    RUN_DIAG      -- 1 to include monitoring and tracing checks
+//    RUN_LIMIT     -- 1 to include the instruction limit check
+//
+// decodeArgs() picks the variant matching the options given so that, for
+// example, a run without tracing makes no tracing checks at all.
+//
+// The generated function runs instructions of machine mc until a stop
+// condition is detected and returns the exit code.  A single step function returns -1
+// if execution is to continue.
+//
+// Both forms execute exactly the same statements for each function code, so
+// leave identical machine states.  The threaded form ends every function
+// code handler with its own copy of the end of instruction checks, fetch and
+// indirect jump, giving each handler its own branch prediction history
+// rather than sharing the one indirect branch the switch compiles to.
+
+
+// fetch and decode next instruction, leaving f, a and m set up
+#define RUN_FETCH							\
+  {									\
+    /* stop at a breakpoint before changing anything; an SCR beyond	\
+       the store faults in the guard pages of decoded */		\
+    if ( mc->decoded[mc->store[mc->scReg]].brk				\
+	 && breakHit(mc, mc->store[mc->scReg]) )			\
+      return EXIT_BREAKSTOP;						\
+									\
+    ++mc->iCount;							\
+									\
+    /* increment SCR */							\
+    mc->lastSCR = mc->store[mc->scReg];					\
+    mc->store[mc->scReg]++;						\
+									\
+    /* fetch instruction, decoding it only if not already predecoded,	\
+       which it never is at a breakpoint, nor before being marked for	\
+       -coverage, nor in the SCR and B registers, so that an SCR run	\
+       through itself fetches the word it has just incremented */	\
+    if ( ! mc->decoded[mc->lastSCR].valid )				\
+      {									\
+	decode(mc, mc->lastSCR);					\
+	if ( mc->coverage != NULL ) coverInstruction(mc, mc->lastSCR);	\
+      }									\
+    mc->instruction = mc->decoded[mc->lastSCR].instruction;		\
+    mc->f = mc->decoded[mc->lastSCR].f;					\
+    mc->a = mc->decoded[mc->lastSCR].a;					\
+    mc->fCount[mc->f]+=1; /* track number of executions of each function code */ \
+									\
+    /* perform B modification if needed */				\
+    if ( mc->decoded[mc->lastSCR].bMod )				\
+      {									\
+	mc->m = (mc->a + mc->store[mc->bReg]) & MASK16;			\
+	mc->emTime += 6;						\
+      }									\
+    else								\
+      mc->m = mc->a & MASK16;						\
+  }
+
+// every instruction accounts for its own time and count
+#define RUN_TIME(n) mc->emTime += fnTime[n]
+#define RUN_SYNC
+#define RUN_COUNT   mc->iCount
+#define RUN_PENDING 0
+
+#if RUN_THREADED
+#define RUN_CASE(n) fn##n
+#define RUN_NEXT							\
+  {									\
+    if   ( (exitCode = endInstruction(mc, RUN_DIAG, RUN_LIMIT)) >= 0 )	\
+      return exitCode;							\
+    RUN_FETCH;								\
+    goto *fnLabel[mc->f];						\
+  }
+#else
+#define RUN_CASE(n) case n
+#define RUN_NEXT    break
+#endif
+
+
+INT32 RUN_NAME (ELLIOTT900 *mc)
+{
+  INT32 exitCode = EXIT_SUCCESS; // reason for terminating
+
+#if RUN_THREADED
+  static void *const fnLabel[16] =
+    {
+      &&fn0,  &&fn1,  &&fn2,  &&fn3,  &&fn4,  &&fn5,  &&fn6,  &&fn7,
+      &&fn8,  &&fn9,  &&fn10, &&fn11, &&fn12, &&fn13, &&fn14, &&fn15
+    };
+
+  RUN_FETCH;
+  goto *fnLabel[mc->f];
+#else
+  // instruction fetch and decode loop
+#if RUN_STEP
+  do
+#else
+  while ( TRUE )
+#endif
+    {
+      RUN_FETCH;
+
+      // perform function determined by function code f
+      switch ( mc->f )
+#endif
+        {
+
+#include "emu900ops.h"
+	} // end function switch
+
+#if ! RUN_THREADED
+      if   ( (exitCode = endInstruction(mc, RUN_DIAG, RUN_LIMIT)) >= 0 ) break;
+    } // end while fetching and decoding instructions
+#if RUN_STEP
+  while ( FALSE );
+#endif
+#endif
+
+  return exitCode;
+}
+
+#undef RUN_FETCH
+#undef RUN_CASE
+#undef RUN_NEXT
+#undef RUN_TIME
+#undef RUN_SYNC
+#undef RUN_COUNT
+#undef RUN_PENDING